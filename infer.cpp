@@ -15,6 +15,7 @@
  */
 
 #include "nnef.h"
+#include "nnef_tools_common.h"
 
 #include <stdio.h>
 #include <string>
@@ -33,40 +34,6 @@
 #define _fileno fileno
 #endif
 
-
-const std::set<std::string> lowered =
-{
-    "separable_conv",
-    "separable_deconv",
-    "rms_pool",
-    "local_response_normalization",
-    "local_mean_normalization",
-    "local_variance_normalization",
-    "local_contrast_normalization",
-    "l1_normalization",
-    "l2_normalization",
-    "batch_normalization",
-    "area_downsample",
-    "nearest_downsample",
-    "nearest_upsample",
-    "linear_quantize",
-    "logarithmic_quantize",
-    "leaky_relu",
-    "prelu",
-    "clamp",
-};
-
-std::string read_file( const char* fn )
-{
-    std::ifstream is(fn);
-    if ( !is )
-    {
-        throw std::runtime_error("file not found: " + std::string(fn));
-    }
-    
-    return std::string((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
-}
-
 bool read_inputs_from_cin( nnef::Graph& graph, std::string& error )
 {
     for ( auto& input : graph.inputs )
@@ -1,48 +1,23 @@
 #include "nnef.h"
+#include "nnef_tools_common.h"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #ifdef _WIN32
 #include <io.h>
 #else
 #include <unistd.h>
 #endif
 
-const std::set<std::string> lowered =
-{
-    "separable_conv",
-    "separable_deconv",
-    "rms_pool",
-    "local_response_normalization",
-    "local_mean_normalization",
-    "local_variance_normalization",
-    "local_contrast_normalization",
-    "l1_normalization",
-    "l2_normalization",
-    "batch_normalization",
-    "area_downsample",
-    "nearest_downsample",
-    "nearest_upsample",
-    "linear_quantize",
-    "logarithmic_quantize",
-    "leaky_relu",
-    "prelu",
-    "clamp",
-};
-
-std::string read_file( const char* fn )
-{
-    std::ifstream is(fn);
-    if ( !is )
-    {
-        throw std::runtime_error("file not found: " + std::string(fn));
-    }
-    
-    return std::string((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
-}
-
 std::string tensor_type( const std::string& dtype )
 {
     if ( dtype == "scalar" )
@@ -87,12 +62,11 @@ std::string tensor_extents( const std::vector<int>& shape )
     return ext.str();
 }
 
-static std::vector<std::string> op_list;
+static std::unordered_set<std::string> op_names;
 
 std::string tensor_id( const std::string& id )
 {
-    auto pos = std::find(op_list.cbegin(), op_list.cend(), id);
-    return (pos == op_list.end()? id: id + "_0");
+    return (op_names.count(id) == 0? id: id + "_0");
 }
 
 std::string tensor_typename( const nnef::Tensor& tensor )
@@ -105,6 +79,186 @@ std::string tensor_declaration( const nnef::Tensor& tensor )
     return tensor_id(tensor.name) + ": " + tensor_typename(tensor) + " (" + tensor_extents(tensor.shape) + ");";
 }
 
+const size_t workspace_alignment = 64;
+
+size_t element_size( const std::string& dtype )
+{
+    return dtype == "logical" ? 1 : 4;    // Boolean, Float or Integer
+}
+
+size_t tensor_bytes( const nnef::Tensor& tensor )
+{
+    size_t size = element_size(tensor.dtype);
+    for ( const auto& extent : tensor.shape )
+    {
+        size *= extent;
+    }
+    return (size + workspace_alignment - 1) / workspace_alignment * workspace_alignment;
+}
+
+std::vector<size_t> workspace_sizes( const nnef::Graph& graph, const std::vector<std::string>& intermediates )
+{
+    std::vector<size_t> sizes;
+    for ( const auto& id : intermediates )
+    {
+        sizes.push_back(tensor_bytes(graph.tensors.at(id)));
+    }
+    return sizes;
+}
+
+// Workspace for the intermediates when Forward runs its operations in order
+storage_plan plan_workspace( const nnef::Graph& graph, const std::vector<std::string>& intermediates,
+                             const std::vector<size_t>& positions = std::vector<size_t>() )
+{
+    return plan_storage(graph, intermediates, workspace_sizes(graph, intermediates), positions);
+}
+
+std::string workspace_declaration( const nnef::Tensor& tensor, const size_t offset )
+{
+    return tensor_id(tensor.name) + ": " + tensor_typename(tensor) + " (" + tensor_extents(tensor.shape) + ")" +
+           " with Import, Address => Workspace (" + std::to_string(offset + 1) + ")'Address;";
+}
+
+// Data of all variables packed into one read-only blob, each tensor aligned to
+// workspace_alignment; the views of the variables are overlaid on the blob
+struct weights_blob
+{
+    std::unordered_map<std::string, size_t> offsets;
+    std::vector<char> data;
+};
+
+bool pack_weights( const nnef::Graph& graph, weights_blob& blob, std::string& error )
+{
+    for ( const auto& operation : graph.operations )
+    {
+        if ( operation.name != "variable" )
+        {
+            continue;
+        }
+        for ( const auto& output : operation.outputs )
+        {
+            const auto& id = output.second.identifier();
+            const auto& tensor = graph.tensors.at(id);
+            const size_t size = tensor_bytes(tensor);
+            size_t bytes = element_size(tensor.dtype);
+            for ( const auto& extent : tensor.shape )
+            {
+                bytes *= extent;
+            }
+            if ( tensor.data.size() != bytes )
+            {
+                error = "data of variable '" + id + "' is not loaded; the model must be a folder with binary data";
+                return false;
+            }
+            blob.offsets[id] = blob.data.size();
+            blob.data.insert(blob.data.end(), tensor.data.begin(), tensor.data.end());
+            blob.data.resize(blob.offsets[id] + size, 0);
+        }
+    }
+    return true;
+}
+
+std::string weights_declaration( const nnef::Tensor& tensor, const std::string& package, const size_t offset )
+{
+    return tensor_id(tensor.name) + ": constant " + tensor_typename(tensor) + " (" + tensor_extents(tensor.shape) + ")" +
+           " with Import, Address => " + package + ".Blob (" + std::to_string(offset + 1) + ")'Address;";
+}
+
+std::string lower_case( std::string str )
+{
+    std::transform(str.begin(), str.end(), str.begin(), []( char ch ){ return (char)std::tolower((unsigned char)ch); });
+    return str;
+}
+
+// The blob holds the variables in the byte order of the host, so the target must match it
+bool little_endian_host()
+{
+    const unsigned short one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+void write_byte_order_check( std::ostream& os )
+{
+    const std::string order = little_endian_host() ? "Low_Order_First" : "High_Order_First";
+    os << "    pragma Compile_Time_Error (System.Default_Bit_Order /= System." << order << "," << std::endl;
+    os << "        \"weights are stored " << (little_endian_host() ? "little" : "big") << "-endian\");" << std::endl;
+}
+
+// Above this size a Blob aggregate is very slow to compile; --weights object should be used
+const size_t weights_aggregate_warning_bytes = 4 << 20;
+
+void write_weights_package( std::ostream& os, const std::string& package, const weights_blob& blob )
+{
+    os << "-- " << package << ".ads" << std::endl;
+    os << "with System.Storage_Elements;" << std::endl;
+    os << "package " << package << " is" << std::endl;
+    os << "    pragma Preelaborate;" << std::endl;
+    write_byte_order_check(os);
+    os << "    Blob: constant System.Storage_Elements.Storage_Array (1.." << std::max<size_t>(blob.data.size(), 1) << ") := (";
+    for ( size_t i = 0; i < blob.data.size(); ++i )
+    {
+        os << (i % 16 ? " " : "\n        ") << (unsigned)(unsigned char)blob.data[i] << ",";
+    }
+    os << std::endl << "        others => 0) with Alignment => " << workspace_alignment << ";" << std::endl;
+    os << "end " << package << ";" << std::endl;
+}
+
+// Writes <package>.bin and <package>.s to dir, or to the working directory if dir is empty. The
+// assembly is for the GNU assembler and ELF targets (.type and .size fail elsewhere), and .incbin
+// gets an absolute path since the assembler resolves it from its own working directory
+bool write_weights_object( const std::string& dir, const std::string& package, const weights_blob& blob, std::string& error )
+{
+#if defined(_WIN32) || defined(__APPLE__)
+    error = "--weights object emits GNU assembly for ELF targets only; use --weights ada";
+    return false;
+#else
+    const std::string symbol = lower_case(package);
+    const std::string file = dir.empty() ? package : dir + "/" + package;
+    const std::string binary = file + ".bin";
+    std::string path = binary;
+    if ( path[0] != '/' )
+    {
+        char cwd[4096];
+        if ( !getcwd(cwd, sizeof(cwd)) )
+        {
+            error = "could not get the working directory for the path of " + binary;
+            return false;
+        }
+        path = std::string(cwd) + "/" + binary;
+    }
+    std::ofstream bin(binary, std::ios::binary);
+    bin.write(blob.data.data(), blob.data.size());
+    std::ofstream as(file + ".s");
+    as << "/* GNU assembler, ELF targets only; " << (little_endian_host() ? "little" : "big") << "-endian data */" << std::endl;
+    as << "    .section .rodata" << std::endl;
+    as << "    .balign " << workspace_alignment << std::endl;
+    as << "    .globl " << symbol << std::endl;
+    as << "    .type " << symbol << ", STT_OBJECT" << std::endl;
+    as << symbol << ":" << std::endl;
+    as << "    .incbin \"" << path << "\"" << std::endl;
+    as << "    .size " << symbol << ", . - " << symbol << std::endl;
+    if ( !bin || !as )
+    {
+        error = "could not write weights object files: " + binary + ", " + file + ".s";
+        return false;
+    }
+    return true;
+#endif
+}
+
+void write_weights_import( std::ostream& os, const std::string& package, const weights_blob& blob )
+{
+    os << "-- " << package << ".ads" << std::endl;
+    os << "with System.Storage_Elements;" << std::endl;
+    os << "package " << package << " is" << std::endl;
+    os << "    pragma Preelaborate;" << std::endl;
+    write_byte_order_check(os);
+    os << "    -- Linked from " << package << ".s, which includes " << package << ".bin" << std::endl;
+    os << "    Blob: constant System.Storage_Elements.Storage_Array (1.." << std::max<size_t>(blob.data.size(), 1) << ")" << std::endl;
+    os << "        with Import, Convention => C, External_Name => \"" << lower_case(package) << "\", Alignment => " << workspace_alignment << ";" << std::endl;
+    os << "end " << package << ";" << std::endl;
+}
+
 std::ostringstream& operator <<( std::ostringstream& os, const nnef::Value& value )
 {
     switch (value.kind())
@@ -226,234 +380,1390 @@ std::string param_description( const nnef::Graph& graph, const nnef::Operation&
     return attr + " => " + os.str();
 }
 
-int main( int argc, const char * argv[] )
+// Writes the call of one operation in Forward, without indentation and line end
+void write_operation_call( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation )
 {
-    if ( argc < 2 )
+    size_t i = 0;
+    os << operation.name << " (";
+
+    for ( ; i<operation.inputs.size(); ++i )
     {
-        std::cerr << "Input file name must be provided" << std::endl;
-        return -1;
+        if (i) os << ", ";
+        const auto& input = operation.inputs[i];
+        if ((operation.name == "add" || operation.name == "mul") &&
+            i == 0 && input.second.kind() != nnef::Value::Kind::Identifier &&
+            operation.inputs.size() >= 2 && operation.inputs[i+1].second.kind() == nnef::Value::Kind::Identifier)
+        {
+            const auto& input1 = operation.inputs[i+1];
+            os << input.first << " => " << tensor_id(input1.second.identifier());
+            os << ", ";
+            os << input1.first << " => " << input.second;
+            ++i;
+        }
+        else if (input.second.kind() == nnef::Value::Kind::Identifier)
+        {
+            auto& id = input.second.identifier();
+            os << input.first << " => " << tensor_id(id);
+        }
+        else
+        {
+            os << input.first << " => " << input.second;
+        }
     }
-    
-    const std::string path = argv[1];
-    std::string stdlib;
-    
-    for ( size_t i = 2; i < argc; ++i )
+
+    if ( operation.name != "reshape" )
     {
-        const std::string arg = argv[i];
-        if ( arg == "--stdlib" )
+        for ( const auto& attr : operation.attribs )
+        {
+            if (i++) os << ", ";
+            os << param_description(graph, operation, attr.first, attr.second);
+        }
+    }
+
+    for ( const auto& output : operation.outputs )
+    {
+        if (i++) os << ", ";
+        os << output.first << " => " << tensor_id(output.second.identifier());
+    }
+    os << ");";
+}
+
+bool is_computation( const nnef::Operation& operation )
+{
+    return operation.name != "external" && operation.name != "variable";
+}
+
+// Elementwise operations that can be fused into one loop nest, with the Ada expression
+// of one item; %1, %2 and %3 stand for the items of the operands in order
+const std::map<std::string, std::string> elementwise =
+{
+    { "copy", "%1" },
+    { "neg", "(-%1)" },
+    { "rcp", "1.0 / %1" },
+    { "sqr", "%1 * %1" },
+    { "abs", "abs %1" },
+    { "relu", "Float'Max (%1, 0.0)" },
+    { "sqrt", "Ada.Numerics.Elementary_Functions.Sqrt (%1)" },
+    { "rsqrt", "1.0 / Ada.Numerics.Elementary_Functions.Sqrt (%1)" },
+    { "exp", "Ada.Numerics.Elementary_Functions.Exp (%1)" },
+    { "log", "Ada.Numerics.Elementary_Functions.Log (%1)" },
+    { "tanh", "Ada.Numerics.Elementary_Functions.Tanh (%1)" },
+    { "sigmoid", "1.0 / (1.0 + Ada.Numerics.Elementary_Functions.Exp (-%1))" },
+    { "add", "%1 + %2" },
+    { "sub", "%1 - %2" },
+    { "mul", "%1 * %2" },
+    { "div", "%1 / %2" },
+    { "min", "Float'Min (%1, %2)" },
+    { "max", "Float'Max (%1, %2)" },
+    { "lt", "%1 < %2" },
+    { "gt", "%1 > %2" },
+    { "le", "%1 <= %2" },
+    { "ge", "%1 >= %2" },
+    { "eq", "%1 = %2" },
+    { "ne", "%1 /= %2" },
+    { "and", "%1 and %2" },
+    { "or", "%1 or %2" },
+    { "not", "not %1" },
+    { "select", "(if %1 then %2 else %3)" },
+};
+
+// Groups of elementwise operations computed in one loop nest; an operation joins the group
+// of the single operation that consumes its output if both have the same output shape,
+// and the group is computed at the position of its last (root) operation
+struct fusion_plan
+{
+    std::vector<size_t> root;                               // per operation
+    std::map<size_t, std::vector<size_t>> groups;           // operations per root, for groups of 2 or more
+    std::unordered_set<std::string> eliminated;             // outputs computed only inside loops
+};
+
+bool fusable( const nnef::Graph& graph, const nnef::Operation& operation )
+{
+    if ( !elementwise.count(operation.name) || operation.outputs.size() != 1 ||
+         operation.outputs[0].second.kind() != nnef::Value::Kind::Identifier )
+    {
+        return false;
+    }
+    const auto& output = graph.tensors.at(operation.outputs[0].second.identifier());
+    if ( output.shape.empty() || output.dtype == "integer" )
+    {
+        return false;
+    }
+    for ( const auto& input : operation.inputs )
+    {
+        const auto& value = input.second;
+        if ( value.kind() == nnef::Value::Kind::Identifier )
         {
-            if ( i+1 >= argc && *argv[i+1] != '-' )
+            const auto& tensor = graph.tensors.at(value.identifier());
+            if ( tensor.dtype == "integer" || tensor.shape.size() > output.shape.size() )
             {
-                std::cerr << "Stdlib file name must be provided after --stdlib; ignoring option" << std::endl;
+                return false;
             }
-            else
-            try
+            for ( size_t d = 0; d < tensor.shape.size(); ++d )
             {
-                stdlib = read_file(argv[i]);
+                if ( tensor.shape[d] != output.shape[d] && tensor.shape[d] != 1 )
+                {
+                    return false;
+                }
             }
-            catch ( std::runtime_error e )
+        }
+        else if ( value.kind() != nnef::Value::Kind::Scalar && value.kind() != nnef::Value::Kind::Logical &&
+                  value.kind() != nnef::Value::Kind::Integer )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+fusion_plan plan_fusion( const nnef::Graph& graph, const std::unordered_set<std::string>& graph_outputs )
+{
+    std::unordered_map<std::string, std::vector<size_t>> consumers;
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        std::vector<std::string> ids;
+        for ( const auto& input : graph.operations[i].inputs )
+        {
+            collect_identifiers(input.second, ids);
+        }
+        for ( const auto& id : ids )
+        {
+            auto& list = consumers[id];
+            if ( list.empty() || list.back() != i )
             {
-                std::cerr << e.what() << std::endl;
+                list.push_back(i);
             }
         }
-        else
+    }
+
+    fusion_plan plan;
+    plan.root.resize(graph.operations.size());
+    for ( size_t i = graph.operations.size(); i--; )
+    {
+        const auto& operation = graph.operations[i];
+        plan.root[i] = i;
+        if ( !fusable(graph, operation) )
         {
-            std::cerr << "Unrecognized option: " << argv[i] << "; ignoring" << std::endl;
+            continue;
         }
+        const auto& id = operation.outputs[0].second.identifier();
+        const auto& list = consumers[id];
+        if ( graph_outputs.count(id) || list.size() != 1 || !fusable(graph, graph.operations[list[0]]) )
+        {
+            continue;
+        }
+        const auto& consumer = graph.operations[list[0]];
+        const auto& consumer_output = graph.tensors.at(consumer.outputs[0].second.identifier());
+        if ( consumer_output.shape != graph.tensors.at(id).shape )
+        {
+            continue;
+        }
+        plan.root[i] = plan.root[list[0]];
+        plan.eliminated.insert(id);
     }
 
-    nnef::Graph graph;
-    std::string error;
-    
-    if ( !nnef::load_graph(path, graph, error, stdlib, lowered) )
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
     {
-        std::cerr << error << std::endl;
-        return -2;
+        if ( plan.root[i] != i )
+        {
+            auto& group = plan.groups[plan.root[i]];
+            if ( group.empty() )
+            {
+                group.push_back(plan.root[i]);
+            }
+            group.insert(group.end() - 1, i);
+        }
     }
+    return plan;
+}
 
-    if ( !nnef::infer_shapes(graph, error) )
+std::string real_literal( const double value )
+{
+    std::ostringstream os;
+    os << value;
+    std::string literal = os.str();
+    if ( literal.find_first_of(".en") == std::string::npos )
     {
-        std::cerr << error << std::endl;
-        return -3;
+        literal += ".0";
     }
+    else if ( literal.find('.') == std::string::npos && literal.find('e') != std::string::npos )
+    {
+        literal.insert(literal.find('e'), ".0");
+    }
+    return value < 0 ? "(" + literal + ")" : literal;
+}
 
-    std::ostringstream declarations;
-    std::ostringstream load;
-    std::ostringstream fwd_decl;
-    std::ostringstream fwd_text;
+std::string item_type( const std::string& dtype )
+{
+    return dtype == "logical" ? "Boolean" : "Float";
+}
 
-    std::set<std::string> external_types;
-    std::set<std::string> variable_types;
-    std::set<std::string> output_types;
-    std::set<std::string> all_types;
+void write_fused_loop( std::ostream& os, const nnef::Graph& graph, const std::vector<size_t>& group, const std::string& indent )
+{
+    const auto& root = graph.operations[group.back()];
+    const auto& output = graph.tensors.at(root.outputs[0].second.identifier());
+    const size_t rank = output.shape.size();
 
-    size_t i = 0;
+    os << indent << "-- fused:";
+    for ( const auto& i : group )
+    {
+        os << " " << graph.operations[i].name;
+    }
+    os << std::endl;
 
-    for ( const auto& operation : graph.operations )
+    std::string inner = indent;
+    for ( size_t d = 0; d < rank; ++d )
     {
-        auto pos = std::find(op_list.cbegin(), op_list.cend(), operation.name);
-        if (pos == op_list.end())
-        {
-            op_list.push_back(operation.name);
-        }
+        os << inner << "for I" << d + 1 << " in 1.." << output.shape[d] << " loop" << std::endl;
+        inner += "    ";
     }
-    op_list.push_back("local_response_normalization");
 
-    for ( const auto& operation : graph.operations )
+    std::unordered_map<std::string, std::string> items;    // expressions of eliminated tensors
+    os << inner << "declare" << std::endl;
+    for ( size_t k = 0; k < group.size(); ++k )
     {
-	    if (operation.name == "external")
-	    {
-            for ( const auto& output : operation.outputs )
-            {
-                const auto& id = output.second.identifier();
-                const auto& tensor = graph.tensors.at(id);
-                const auto& shape = operation.attribs.get("shape");
-                load << "    " + operation.name + " (\"" + tensor.name + "\", " + tensor_id(tensor.name) + ");" << std::endl;
-                external_types.insert(tensor_typename(tensor));
-                all_types.insert(tensor_typename(tensor));
-            }
-	    }
-	    else if (operation.name == "variable")
-	    {
-            for ( const auto& output : operation.outputs )
-            {
-                const auto& id = output.second.identifier();
-                const auto& tensor = graph.tensors.at(id);
-                const auto& label = operation.attribs.get("label");
-                const auto& shape = operation.attribs.get("shape");
-                declarations << "    " << tensor_declaration(tensor) << std::endl;
-                load << "    " + operation.name + " (\"" + label.string() + "\", " + tensor_id(tensor.name) + ");" << std::endl;
-                variable_types.insert(tensor_typename(tensor));
-                all_types.insert(tensor_typename(tensor));
-            }
-	    }
-        else
-        {
-            size_t i = 0;
-            fwd_text << "        " << operation.name << " (";
+        const auto& operation = graph.operations[group[k]];
+        const auto& result = graph.tensors.at(operation.outputs[0].second.identifier());
 
-            for ( ; i<operation.inputs.size(); ++i )
+        std::string expression = elementwise.at(operation.name);
+        for ( size_t j = operation.inputs.size(); j--; )
+        {
+            const auto& value = operation.inputs[j].second;
+            std::string operand;
+            if ( value.kind() == nnef::Value::Kind::Identifier )
             {
-                if (i) fwd_text << ", ";
-                const auto& input = operation.inputs[i];
-                if ((operation.name == "add" || operation.name == "mul") &&
-                    i == 0 && input.second.kind() != nnef::Value::Kind::Identifier &&
-                    operation.inputs.size() >= 2 && operation.inputs[i+1].second.kind() == nnef::Value::Kind::Identifier)
-                {
-                    const auto& input1 = operation.inputs[i+1];
-                    fwd_text << input.first << " => " << tensor_id(input1.second.identifier());
-                    fwd_text << ", ";
-                    fwd_text << input1.first << " => " << input.second;
-                    ++i;
-                }
-                else if (input.second.kind() == nnef::Value::Kind::Identifier)
+                auto it = items.find(value.identifier());
+                if ( it != items.end() )
                 {
-                    auto& id = input.second.identifier();
-                    fwd_text << input.first << " => " << tensor_id(id);
+                    operand = it->second;
                 }
                 else
                 {
-                    fwd_text << input.first << " => " << input.second;
+                    const auto& tensor = graph.tensors.at(value.identifier());
+                    operand = tensor_id(tensor.name) + " (";
+                    for ( size_t d = 0; d < tensor.shape.size(); ++d )
+                    {
+                        if (d) operand += ", ";
+                        operand += tensor.shape[d] == 1 && output.shape[d] != 1 ? std::string("1") : "I" + std::to_string(d + 1);
+                    }
+                    operand += ")";
                 }
             }
-
-            if ( operation.name != "reshape" )
+            else if ( value.kind() == nnef::Value::Kind::Logical )
             {
-                for ( const auto& attr : operation.attribs )
-                {
-                    if (i++) fwd_text << ", ";
-                    fwd_text << param_description(graph, operation, attr.first, attr.second);
-                }
+                operand = value.logical() ? "True" : "False";
+            }
+            else
+            {
+                operand = real_literal(value.kind() == nnef::Value::Kind::Scalar ? value.scalar() : value.integer());
+            }
+            const std::string placeholder = "%" + std::to_string(j + 1);
+            for ( size_t pos; (pos = expression.find(placeholder)) != std::string::npos; )
+            {
+                expression.replace(pos, placeholder.size(), operand);
             }
+        }
 
-            for ( const auto& output : operation.outputs )
+        if ( k + 1 < group.size() )
+        {
+            const std::string item = "T" + std::to_string(k + 1);
+            os << inner << "    " << item << ": constant " << item_type(result.dtype) << " := " << expression << ";" << std::endl;
+            items[result.name] = item;
+        }
+        else
+        {
+            os << inner << "begin" << std::endl;
+            os << inner << "    " << tensor_id(result.name) << " (";
+            for ( size_t d = 0; d < rank; ++d )
             {
-                const auto& id = output.second.identifier();
-                const auto& tensor = graph.tensors.at(id);
-                if (i++) fwd_text << ", ";
-                auto pos = std::find(graph.outputs.cbegin(), graph.outputs.cend(), id);
-                if (pos == graph.outputs.end())
-                {
-                    fwd_decl << "        " << tensor_declaration(tensor) << std::endl;
-                }
-                else
-                {
-                    output_types.insert(tensor_typename(tensor));
-                }
-                fwd_text << output.first << " => " << tensor_id(output.second.identifier());
-                all_types.insert(tensor_typename(tensor));
+                os << (d ? ", " : "") << "I" << d + 1;
             }
-            fwd_text << ");" << std::endl;
+            os << ") := " << expression << ";" << std::endl;
+            os << inner << "end;" << std::endl;
         }
     }
 
-    std::cout << "-- " << graph.name << ".ads" << std::endl;
-    std::cout << "with Generic_Real_Arrays;" << std::endl;
-    std::cout << "with Generic_Real_Arrays.Operators;" << std::endl;
-    std::cout << "package " << graph.name << " is" << std::endl;
-    std::cout << "    pragma Preelaborate;" << std::endl;
-    std::cout << "    package Real_Arrays is new Generic_Real_Arrays(Real => Float);" << std::endl;
-    std::cout << "    package Operators is new Real_Arrays.Operators;" << std::endl;
-    std::cout << "    use Real_Arrays;" << std::endl;
-    std::cout << "    use Operators;" << std::endl;
-    for ( const auto& input : graph.inputs )
+    for ( size_t d = rank; d--; )
     {
-        const auto& tensor = graph.tensors.at(input);
-        std::cout << "    " << tensor_declaration(tensor) << std::endl;
+        inner.resize(inner.size() - 4);
+        os << inner << "end loop;" << std::endl;
     }
-    for ( const auto& output : graph.outputs )
-    {
-        const auto& tensor = graph.tensors.at(output);
-        std::cout << "    " << tensor_declaration(tensor) << std::endl;
-    }
-    std::cout << declarations.str();
-    std::cout << fwd_decl.str();
-    std::cout << "    procedure Forward;" << std::endl;
-    std::cout << "end " << graph.name << ";" << std::endl;
-
-    std::cout << "-- " << graph.name << ".adb" << std::endl;
-    std::cout << "package body " << graph.name << " is" << std::endl;
-    std::cout << "    procedure Forward is" << std::endl;
-    std::cout << "    begin" << std::endl;
-    std::cout << fwd_text.str();
-    std::cout << "    end Forward;" << std::endl;
-    std::cout << "end " << graph.name << ";" << std::endl;
-
-    std::cout << "-- " << graph.name << "_run.adb" << std::endl;
-    std::cout << "with " << graph.name << "; use " << graph.name << ";" << std::endl;
-    std::cout << "use " << graph.name << ".Real_Arrays;" << std::endl;
-    std::cout << "procedure " + graph.name + "_Run is" << std::endl;
-    for (auto type_name: external_types)
+}
+
+// Timing of the operations of Forward; the slots of the duration table are numbered in
+// graph order, and every slot is labeled with the 1-based index of its operation in
+// graph.operations, as in the trace files of infer, so the two profiles can be compared
+struct profile_plan
+{
+    std::vector<size_t> slot;                   // per operation, 0 if not timed
+    std::vector<std::string> labels;            // per slot
+    std::vector<size_t> types;                  // per slot, 1-based index into type_names
+    std::vector<std::string> type_names;
+};
+
+std::string padded( const std::string& str, const size_t width )
+{
+    return str + std::string(width > str.size() ? width - str.size() : 0, ' ');
+}
+
+profile_plan plan_profile( const nnef::Graph& graph, const fusion_plan& fusion )
+{
+    profile_plan plan;
+    plan.slot.assign(graph.operations.size(), 0);
+    std::vector<std::string> names, outputs;
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
     {
-        std::cout << "    procedure External (Var_Name: String; Tensor: out " + type_name + ") is" << std::endl;
-        std::cout << "    begin" << std::endl;
-        std::cout << "        null;" << std::endl;
-        std::cout << "    end External;" << std::endl;
+        const auto& operation = graph.operations[i];
+        if ( !is_computation(operation) || (!fusion.root.empty() && fusion.root[i] != i) )
+        {
+            continue;
+        }
+        std::vector<std::string> ids;
+        for ( const auto& output : operation.outputs )
+        {
+            collect_identifiers(output.second, ids);
+        }
+        plan.slot[i] = names.size() + 1;
+        names.push_back(fusion.groups.count(i) ? "fused_" + operation.name : operation.name);
+        outputs.push_back(ids.empty() ? std::string() : ids.front());
     }
-    for (auto type_name: variable_types)
+
+    size_t width = 0;
+    for ( const auto& name : names )
     {
-        std::cout << "    procedure Variable (Var_Name: String; Tensor: out " + type_name + ") is" << std::endl;
-        std::cout << "    begin" << std::endl;
-        std::cout << "        null;" << std::endl;
-        std::cout << "    end Variable;" << std::endl;
+        width = std::max(width, name.size());
     }
-    for (auto type_name: output_types)
+    std::map<std::string, size_t> types;
+    for ( size_t k = 0; k < names.size(); ++k )
     {
-        std::cout << "    procedure Output (Tensor: " + type_name + "; Var_Name: String) is" << std::endl;
-        std::cout << "    begin" << std::endl;
-        std::cout << "        null;" << std::endl;
-        std::cout << "    end Output;" << std::endl;
+        auto it = types.find(names[k]);
+        if ( it == types.end() )
+        {
+            it = types.insert(std::make_pair(names[k], types.size() + 1)).first;
+            plan.type_names.push_back(names[k]);
+        }
+        plan.types.push_back(it->second);
     }
-
-    std::cout << "begin" << std::endl;
-    std::cout << load.str();
-    std::cout << "    Forward;" << std::endl;
-    for ( const auto& output : graph.outputs )
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        if ( plan.slot[i] )
+        {
+            std::ostringstream label;
+            label << std::setw(6) << i + 1 << " " << padded(names[plan.slot[i] - 1], width) << " " << outputs[plan.slot[i] - 1];
+            plan.labels.push_back(label.str());
+        }
+    }
+    return plan;
+}
+
+// Ada aggregate of the given items; a single item needs named association
+std::string aggregate( const std::vector<std::string>& items )
+{
+    std::string str = items.size() == 1 ? "(1 => " : "(";
+    for ( size_t i = 0; i < items.size(); ++i )
+    {
+        str += (i ? ", " : "") + items[i];
+    }
+    return str + ")";
+}
+
+std::vector<std::string> string_items( const std::vector<std::string>& strs, size_t& width )
+{
+    width = 0;
+    for ( const auto& str : strs )
+    {
+        width = std::max(width, str.size());
+    }
+    std::vector<std::string> items;
+    for ( const auto& str : strs )
+    {
+        items.push_back("\"" + padded(str, width) + "\"");
+    }
+    return items;
+}
+
+// With concurrent operations (tasks) the durations add up to CPU time, so the wall time
+// of Forward is measured separately
+void write_profile_table( std::ostream& os, const profile_plan& profile, const bool concurrent )
+{
+    std::vector<std::string> types;
+    for ( const auto& type : profile.types )
+    {
+        types.push_back(std::to_string(type));
+    }
+    size_t label_width, type_width;
+    const auto labels = string_items(profile.labels, label_width);
+    const auto type_names = string_items(profile.type_names, type_width);
+    os << "    -- Durations of the operations of Forward, accumulated over runs" << std::endl;
+    os << "    Profile_Durations: array (1.." << profile.labels.size() << ") of Ada.Real_Time.Time_Span := (others => Ada.Real_Time.Time_Span_Zero);" << std::endl;
+    os << "    Profile_Labels: constant array (Profile_Durations'Range) of String (1.." << label_width << ") := " << aggregate(labels) << ";" << std::endl;
+    os << "    Profile_Types: constant array (Profile_Durations'Range) of Positive := " << aggregate(types) << ";" << std::endl;
+    os << "    Profile_Type_Names: constant array (1.." << profile.type_names.size() << ") of String (1.." << type_width << ") := " << aggregate(type_names) << ";" << std::endl;
+    if ( concurrent )
+    {
+        os << "    Profile_Wall_Time: Ada.Real_Time.Time_Span := Ada.Real_Time.Time_Span_Zero;" << std::endl;
+    }
+}
+
+void write_profile_start( std::ostream& os, const std::string& indent, const size_t slot )
+{
+    if ( slot )
+    {
+        os << indent << "Profile_Start := Ada.Real_Time.Clock;" << std::endl;
+    }
+}
+
+void write_profile_stop( std::ostream& os, const std::string& indent, const size_t slot )
+{
+    if ( slot )
+    {
+        os << indent << "Profile_Durations (" << slot << ") := Profile_Durations (" << slot << ") + (Ada.Real_Time.Clock - Profile_Start);" << std::endl;
+    }
+}
+
+void write_profile_report( std::ostream& os, const profile_plan& profile, const bool concurrent )
+{
+    os << "    procedure Reset_Profile is" << std::endl;
+    os << "    begin" << std::endl;
+    os << "        Profile_Durations := (others => Ada.Real_Time.Time_Span_Zero);" << std::endl;
+    if ( concurrent )
+    {
+        os << "        Profile_Wall_Time := Ada.Real_Time.Time_Span_Zero;" << std::endl;
+    }
+    os << "    end Reset_Profile;" << std::endl;
+    os << "    procedure Print_Profile (Runs: Positive) is" << std::endl;
+    os << "        Times: array (Profile_Durations'Range) of Float;" << std::endl;
+    os << "        Type_Times: array (Profile_Type_Names'Range) of Float := (others => 0.0);" << std::endl;
+    os << "        Type_Counts: array (Profile_Type_Names'Range) of Natural := (others => 0);" << std::endl;
+    os << "        Total: Float := 0.0;" << std::endl;
+    os << "        procedure Put_Time (Time: Float) is" << std::endl;
+    os << "        begin" << std::endl;
+    os << "            Ada.Float_Text_IO.Put (Time, Fore => 9, Aft => 3, Exp => 0);" << std::endl;
+    os << "            Ada.Float_Text_IO.Put (100.0 * Time / Float'Max (Total, Float'Model_Small), Fore => 5, Aft => 1, Exp => 0);" << std::endl;
+    os << "            Ada.Text_IO.Put (\" %\");" << std::endl;
+    os << "        end Put_Time;" << std::endl;
+    os << "    begin" << std::endl;
+    os << "        for I in Times'Range loop" << std::endl;
+    os << "            Times (I) := Float (Ada.Real_Time.To_Duration (Profile_Durations (I))) * 1.0E6 / Float (Runs);" << std::endl;
+    os << "            Total := Total + Times (I);" << std::endl;
+    os << "            Type_Times (Profile_Types (I)) := Type_Times (Profile_Types (I)) + Times (I);" << std::endl;
+    os << "            Type_Counts (Profile_Types (I)) := Type_Counts (Profile_Types (I)) + 1;" << std::endl;
+    os << "        end loop;" << std::endl;
+    os << "        Ada.Text_IO.Put_Line (\"Operations, microseconds per run over\" & Positive'Image (Runs) & \" runs:\");" << std::endl;
+    os << "        for I in Times'Range loop" << std::endl;
+    os << "            Ada.Text_IO.Put (Profile_Labels (I));" << std::endl;
+    os << "            Put_Time (Times (I));" << std::endl;
+    os << "            Ada.Text_IO.New_Line;" << std::endl;
+    os << "        end loop;" << std::endl;
+    os << "        Ada.Text_IO.Put_Line (\"Operation types:\");" << std::endl;
+    os << "        for I in Type_Times'Range loop" << std::endl;
+    os << "            Ada.Text_IO.Put (Profile_Type_Names (I));" << std::endl;
+    os << "            Put_Time (Type_Times (I));" << std::endl;
+    os << "            Ada.Text_IO.Put_Line (\" in\" & Natural'Image (Type_Counts (I)) & \" operations\");" << std::endl;
+    os << "        end loop;" << std::endl;
+    size_t width;
+    string_items(profile.type_names, width);
+    os << "        Ada.Text_IO.Put (\"" << padded(concurrent ? "Total CPU" : "Total", width) << "\");" << std::endl;
+    os << "        Put_Time (Total);" << std::endl;
+    os << "        Ada.Text_IO.New_Line;" << std::endl;
+    if ( concurrent )
+    {
+        os << "        Ada.Text_IO.Put (\"" << padded("Wall", width) << "\");" << std::endl;
+        os << "        Put_Time (Float (Ada.Real_Time.To_Duration (Profile_Wall_Time)) * 1.0E6 / Float (Runs));" << std::endl;
+        os << "        Ada.Text_IO.New_Line;" << std::endl;
+    }
+    os << "    end Print_Profile;" << std::endl;
+}
+
+// Static list schedule of the computations of Forward on a pool of worker tasks; every
+// worker runs its operations in graph order and waits for operations of other workers
+// it depends on, so the waits cannot form a cycle
+struct task_schedule
+{
+    std::vector<std::vector<size_t>> workers;       // operation indices per worker
+    std::vector<size_t> worker_of;                  // per operation; workers.size() if not a computation
+    std::vector<std::vector<size_t>> dependencies;  // producing operations per operation
+    size_t total_cost = 0;
+    size_t makespan = 0;
+};
+
+size_t operation_cost( const nnef::Graph& graph, const nnef::Operation& operation )
+{
+    size_t cost = 0;
+    for ( const auto& output : operation.outputs )
+    {
+        std::vector<std::string> ids;
+        collect_identifiers(output.second, ids);
+        for ( const auto& id : ids )
+        {
+            size_t volume = 1;
+            for ( const auto& extent : graph.tensors.at(id).shape )
+            {
+                volume *= extent;
+            }
+            cost += volume;
+        }
+    }
+    return std::max<size_t>(cost, 1);
+}
+
+task_schedule schedule_tasks( const nnef::Graph& graph, const size_t workers )
+{
+    task_schedule schedule;
+    schedule.workers.resize(workers);
+    schedule.worker_of.assign(graph.operations.size(), workers);
+    schedule.dependencies.resize(graph.operations.size());
+
+    std::unordered_map<std::string, size_t> producers;
+    std::vector<size_t> finish(graph.operations.size(), 0);
+    std::vector<size_t> worker_free(workers, 0);
+
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        const auto& operation = graph.operations[i];
+        if ( !is_computation(operation) )
+        {
+            continue;
+        }
+
+        std::vector<std::string> ids;
+        for ( const auto& input : operation.inputs )
+        {
+            collect_identifiers(input.second, ids);
+        }
+        auto& dependencies = schedule.dependencies[i];
+        size_t ready = 0;
+        for ( const auto& id : ids )
+        {
+            auto it = producers.find(id);
+            if ( it != producers.end() && std::find(dependencies.begin(), dependencies.end(), it->second) == dependencies.end() )
+            {
+                dependencies.push_back(it->second);
+                ready = std::max(ready, finish[it->second]);
+            }
+        }
+
+        // earliest start, preferring a worker that produced an input to avoid synchronization
+        size_t best = 0;
+        size_t best_start = std::numeric_limits<size_t>::max();
+        for ( size_t w = 0; w < workers; ++w )
+        {
+            const size_t start = std::max(ready, worker_free[w]);
+            bool local = false;
+            for ( const auto& dependency : dependencies )
+            {
+                local = local || schedule.worker_of[dependency] == w;
+            }
+            if ( start < best_start || (start == best_start && local) )
+            {
+                best = w;
+                best_start = start;
+            }
+        }
+
+        const size_t cost = operation_cost(graph, operation);
+        finish[i] = best_start + cost;
+        worker_free[best] = finish[i];
+        schedule.worker_of[i] = best;
+        schedule.workers[best].push_back(i);
+        schedule.total_cost += cost;
+        schedule.makespan = std::max(schedule.makespan, finish[i]);
+
+        for ( const auto& output : operation.outputs )
+        {
+            std::vector<std::string> outputs;
+            collect_identifiers(output.second, outputs);
+            for ( const auto& id : outputs )
+            {
+                producers[id] = i;
+            }
+        }
+    }
+    return schedule;
+}
+
+// Workspace for Forward running as tasks: an intermediate may take the storage of another one
+// once every use of the other happens before its definition, by the order of operations in each
+// worker and the events between workers. Uses are tracked as vector clocks: the number of
+// leading operations of each worker that happen before an operation
+storage_plan plan_task_workspace( const nnef::Graph& graph, const std::vector<std::string>& intermediates,
+                                  const task_schedule& schedule )
+{
+    const size_t workers = schedule.workers.size();
+    std::vector<size_t> position(graph.operations.size(), 0);     // in the worker, from 1
+    for ( size_t w = 0; w < workers; ++w )
+    {
+        for ( size_t p = 0; p < schedule.workers[w].size(); ++p )
+        {
+            position[schedule.workers[w][p]] = p + 1;
+        }
+    }
+
+    std::vector<size_t> before(graph.operations.size() * workers, 0);
+    auto merge = [&]( size_t* clock, const size_t i )
+    {
+        for ( size_t v = 0; v < workers; ++v )
+        {
+            clock[v] = std::max(clock[v], before[i * workers + v]);
+        }
+        clock[schedule.worker_of[i]] = std::max(clock[schedule.worker_of[i]], position[i]);
+    };
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        const size_t w = schedule.worker_of[i];
+        if ( w == workers )
+        {
+            continue;
+        }
+        size_t* clock = &before[i * workers];
+        if ( position[i] > 1 )
+        {
+            merge(clock, schedule.workers[w][position[i] - 2]);
+        }
+        for ( const auto& dependency : schedule.dependencies[i] )
+        {
+            merge(clock, dependency);
+        }
+    }
+
+    std::unordered_map<std::string, size_t> index;
+    for ( size_t k = 0; k < intermediates.size(); ++k )
+    {
+        index[intermediates[k]] = k;
+    }
+    std::vector<size_t> definition(intermediates.size(), 0);
+    std::vector<size_t> uses(intermediates.size() * workers, 0);   // last use in each worker, from 1
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        const size_t w = schedule.worker_of[i];
+        if ( w == workers )
+        {
+            continue;
+        }
+        const auto& operation = graph.operations[i];
+        std::vector<std::string> ids;
+        for ( const auto& output : operation.outputs )
+        {
+            collect_identifiers(output.second, ids);
+        }
+        const size_t outputs = ids.size();
+        for ( const auto& input : operation.inputs )
+        {
+            collect_identifiers(input.second, ids);
+        }
+        for ( size_t j = 0; j < ids.size(); ++j )
+        {
+            auto it = index.find(ids[j]);
+            if ( it != index.end() )
+            {
+                if ( j < outputs )
+                {
+                    definition[it->second] = i;
+                }
+                uses[it->second * workers + w] = std::max(uses[it->second * workers + w], position[i]);
+            }
+        }
+    }
+
+    auto happens_before = [&]( const size_t a, const size_t i )
+    {
+        for ( size_t v = 0; v < workers; ++v )
+        {
+            if ( uses[a * workers + v] > before[i * workers + v] )
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto released = [&]( const size_t a, const size_t b ){ return happens_before(a, definition[b]); };
+
+    // the next operation of each worker at or after the definition of an intermediate; an
+    // intermediate that happens before all of them is released for every later one too
+    auto retired = [&]( const size_t a, const size_t b )
+    {
+        for ( size_t v = 0; v < workers; ++v )
+        {
+            const auto& operations = schedule.workers[v];
+            auto next = std::lower_bound(operations.begin(), operations.end(), definition[b]);
+            if ( next != operations.end() && !happens_before(a, *next) )
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    return allocate_storage(intermediates, workspace_sizes(graph, intermediates), released, retired);
+}
+
+void write_task_pool( std::ostream& os, const nnef::Graph& graph, const task_schedule& schedule, const profile_plan& profile )
+{
+    const size_t workers = schedule.workers.size();
+
+    // one event for each pair of an operation and another worker that depends on it,
+    // so that every protected entry has a single caller
+    std::map<std::pair<size_t, size_t>, size_t> events;
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        for ( const auto& dependency : schedule.dependencies[i] )
+        {
+            const std::pair<size_t, size_t> edge(dependency, schedule.worker_of[i]);
+            if ( schedule.worker_of[dependency] != schedule.worker_of[i] && !events.count(edge) )
+            {
+                const size_t index = events.size() + 1;
+                events[edge] = index;
+            }
+        }
+    }
+
+    os << "    protected type Completion is" << std::endl;
+    os << "        entry Wait;" << std::endl;
+    os << "        procedure Signal;" << std::endl;
+    os << "    private" << std::endl;
+    os << "        Done: Boolean := False;" << std::endl;
+    os << "    end Completion;" << std::endl;
+    os << "    protected body Completion is" << std::endl;
+    os << "        entry Wait when Done is" << std::endl;
+    os << "        begin" << std::endl;
+    os << "            Done := False;" << std::endl;
+    os << "        end Wait;" << std::endl;
+    os << "        procedure Signal is" << std::endl;
+    os << "        begin" << std::endl;
+    os << "            Done := True;" << std::endl;
+    os << "        end Signal;" << std::endl;
+    os << "    end Completion;" << std::endl;
+    if ( !events.empty() )
+    {
+        os << "    Events: array (1.." << events.size() << ") of Completion;" << std::endl;
+    }
+    os << "    Finish: array (1.." << workers << ") of Completion;" << std::endl;
+    os << "    task type Worker (Index: Positive) is" << std::endl;
+    os << "        entry Start;" << std::endl;
+    os << "    end Worker;" << std::endl;
+    os << "    task body Worker is" << std::endl;
+    if ( !profile.slot.empty() )
+    {
+        os << "        Profile_Start: Ada.Real_Time.Time;" << std::endl;
+    }
+    os << "    begin" << std::endl;
+    os << "        loop" << std::endl;
+    os << "            select" << std::endl;
+    os << "                accept Start;" << std::endl;
+    os << "            or" << std::endl;
+    os << "                terminate;" << std::endl;
+    os << "            end select;" << std::endl;
+    os << "            case Index is" << std::endl;
+    for ( size_t w = 0; w < workers; ++w )
+    {
+        os << "                when " << w + 1 << " =>" << std::endl;
+        std::set<size_t> waited;
+        for ( const auto& i : schedule.workers[w] )
+        {
+            for ( const auto& dependency : schedule.dependencies[i] )
+            {
+                auto it = events.find(std::make_pair(dependency, w));
+                if ( it != events.end() && waited.insert(it->second).second )
+                {
+                    os << "                    Events (" << it->second << ").Wait;" << std::endl;
+                }
+            }
+            const size_t slot = profile.slot.empty() ? 0 : profile.slot[i];
+            write_profile_start(os, "                    ", slot);
+            os << "                    ";
+            write_operation_call(os, graph, graph.operations[i]);
+            os << std::endl;
+            write_profile_stop(os, "                    ", slot);
+            for ( auto it = events.lower_bound(std::make_pair(i, (size_t)0)); it != events.end() && it->first.first == i; ++it )
+            {
+                os << "                    Events (" << it->second << ").Signal;" << std::endl;
+            }
+        }
+        if ( schedule.workers[w].empty() )
+        {
+            os << "                    null;" << std::endl;
+        }
+    }
+    os << "                when others =>" << std::endl;
+    os << "                    null;" << std::endl;
+    os << "            end case;" << std::endl;
+    os << "            Finish (Index).Signal;" << std::endl;
+    os << "        end loop;" << std::endl;
+    os << "    end Worker;" << std::endl;
+    for ( size_t w = 0; w < workers; ++w )
+    {
+        os << "    Worker_" << w + 1 << ": Worker (" << w + 1 << ");" << std::endl;
+    }
+    os << "    procedure Forward is" << std::endl;
+    if ( !profile.slot.empty() )
+    {
+        os << "        Wall_Start: constant Ada.Real_Time.Time := Ada.Real_Time.Clock;" << std::endl;
+    }
+    os << "    begin" << std::endl;
+    for ( size_t w = 0; w < workers; ++w )
+    {
+        os << "        Worker_" << w + 1 << ".Start;" << std::endl;
+    }
+    os << "        for I in Finish'Range loop" << std::endl;
+    os << "            Finish (I).Wait;" << std::endl;
+    os << "        end loop;" << std::endl;
+    if ( !profile.slot.empty() )
+    {
+        os << "        Profile_Wall_Time := Profile_Wall_Time + (Ada.Real_Time.Clock - Wall_Start);" << std::endl;
+    }
+}
+
+bool open_output( std::ofstream& file, const std::string& dir, const std::string& name, std::string& error )
+{
+    file.open(dir + "/" + name);
+    if ( !file )
+    {
+        error = "could not open output file: " + dir + "/" + name;
+        return false;
+    }
+    return true;
+}
+
+int main( int argc, const char * argv[] )
+{
+    if ( argc < 2 )
+    {
+        std::cerr << "Input file name must be provided" << std::endl;
+        return -1;
+    }
+    
+    const std::string path = argv[1];
+    std::string stdlib;
+    bool workspace = false;
+    std::string weights;
+    std::string output_dir;
+    size_t block_size = 0;
+    size_t tasks = 0;
+    bool fuse = false;
+    size_t instrument_runs = 0;
+    
+    for ( size_t i = 2; i < argc; ++i )
+    {
+        const std::string arg = argv[i];
+        if ( arg == "--stdlib" )
+        {
+            if ( i+1 >= argc || *argv[i+1] == '-' )
+            {
+                std::cerr << "Stdlib file name must be provided after --stdlib; ignoring option" << std::endl;
+            }
+            else
+            try
+            {
+                stdlib = read_file(argv[++i]);
+            }
+            catch ( std::runtime_error e )
+            {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+        else if ( arg == "--workspace" )
+        {
+            workspace = true;
+        }
+        else if ( arg == "--weights" )
+        {
+            if ( i+1 < argc && (std::string(argv[i+1]) == "ada" || std::string(argv[i+1]) == "object") )
+            {
+                weights = argv[++i];
+            }
+            else
+            {
+                std::cerr << "Weights format ada or object must be provided after --weights; ignoring option" << std::endl;
+            }
+        }
+        else if ( arg == "--output" )
+        {
+            if ( i+1 >= argc || *argv[i+1] == '-' )
+            {
+                std::cerr << "Output directory must be provided after --output; ignoring option" << std::endl;
+            }
+            else
+            {
+                output_dir = argv[++i];
+            }
+        }
+        else if ( arg == "--block-size" )
+        {
+            if ( i+1 >= argc || std::atoi(argv[i+1]) <= 0 )
+            {
+                std::cerr << "Positive operation count must be provided after --block-size; ignoring option" << std::endl;
+            }
+            else
+            {
+                block_size = (size_t)std::atoi(argv[++i]);
+            }
+        }
+        else if ( arg == "--instrument" )
+        {
+            instrument_runs = 10;
+            if ( i+1 < argc && std::atoi(argv[i+1]) > 0 )
+            {
+                instrument_runs = (size_t)std::atoi(argv[++i]);
+            }
+        }
+        else if ( arg == "--fuse" )
+        {
+            fuse = true;
+        }
+        else if ( arg == "--tasks" )
+        {
+            if ( i+1 >= argc || std::atoi(argv[i+1]) <= 0 )
+            {
+                std::cerr << "Positive worker count must be provided after --tasks; ignoring option" << std::endl;
+            }
+            else
+            {
+                tasks = (size_t)std::atoi(argv[++i]);
+            }
+        }
+        else
+        {
+            std::cerr << "Unrecognized option: " << argv[i] << "; ignoring" << std::endl;
+        }
+    }
+    if ( tasks && block_size )
+    {
+        std::cerr << "Option --block-size is not used with --tasks; ignoring option" << std::endl;
+        block_size = 0;
+    }
+    if ( tasks && fuse )
+    {
+        std::cerr << "Option --fuse is not used with --tasks; ignoring option" << std::endl;
+        fuse = false;
+    }
+
+    nnef::Graph graph;
+    std::string error;
+    
+    if ( !nnef::load_graph(path, graph, error, stdlib, lowered) )
+    {
+        std::cerr << error << std::endl;
+        return -2;
+    }
+
+    if ( !nnef::infer_shapes(graph, error) )
+    {
+        std::cerr << error << std::endl;
+        return -3;
+    }
+
+    for ( const auto& operation : graph.operations )
+    {
+        op_names.insert(operation.name);
+    }
+    op_names.insert("local_response_normalization");
+
+    const std::unordered_set<std::string> graph_outputs(graph.outputs.begin(), graph.outputs.end());
+
+    fusion_plan fusion;
+    if ( fuse )
+    {
+        fusion = plan_fusion(graph, graph_outputs);
+        size_t fused = 0, eliminated_bytes = 0;
+        for ( const auto& group : fusion.groups )
+        {
+            fused += group.second.size();
+        }
+        for ( const auto& id : fusion.eliminated )
+        {
+            eliminated_bytes += tensor_bytes(graph.tensors.at(id));
+        }
+        std::cerr << "Fused " << fused << " elementwise operations into " << fusion.groups.size() << " loops: eliminated "
+                  << fusion.eliminated.size() << " intermediate tensors (" << eliminated_bytes << " bytes)" << std::endl;
+    }
+
+    profile_plan profile;
+    if ( instrument_runs )
+    {
+        profile = plan_profile(graph, fusion);
+        if ( profile.labels.empty() )
+        {
+            std::cerr << "Graph has no operations to instrument; ignoring option --instrument" << std::endl;
+            profile = profile_plan();
+            instrument_runs = 0;
+        }
+    }
+
+    std::vector<std::string> intermediates;
+    for ( const auto& operation : graph.operations )
+    {
+        if ( !is_computation(operation) )
+        {
+            continue;
+        }
+        for ( const auto& output : operation.outputs )
+        {
+            const auto& id = output.second.identifier();
+            if ( !graph_outputs.count(id) && !fusion.eliminated.count(id) )
+            {
+                intermediates.push_back(id);
+            }
+        }
+    }
+
+    const std::string weights_package = graph.name + "_Weights";
+    weights_blob blob;
+    if ( !weights.empty() && !pack_weights(graph, blob, error) )
+    {
+        std::cerr << error << std::endl;
+        return -4;
+    }
+
+    task_schedule schedule;
+    if ( tasks )
+    {
+        schedule = schedule_tasks(graph, tasks);
+        std::cerr << "Scheduled " << tasks << " worker tasks: estimated speedup " << (double)schedule.total_cost / std::max<size_t>(schedule.makespan, 1) << std::endl;
+    }
+
+    storage_plan plan;
+    if ( workspace )
+    {
+        plan = tasks ? plan_task_workspace(graph, intermediates, schedule) : plan_workspace(graph, intermediates, fusion.root);
+        std::cerr << "Planned workspace: " << plan.size << " bytes for " << intermediates.size() << " intermediate tensors ("
+                  << plan.unshared_size << " bytes without reuse)" << std::endl;
+    }
+
+    // The units are streamed to separate files in the output directory; on stdout they are
+    // concatenated, which needs no buffering since each unit is complete before the next starts
+    std::ofstream weights_file, spec_file, body_file, run_file;
+    std::ostream* weights_os = &std::cout;
+    std::ostream* spec = &std::cout;
+    std::ostream* body = &std::cout;
+    std::ostream* run = &std::cout;
+    const std::string unit_name = lower_case(graph.name);
+    if ( !output_dir.empty() )
+    {
+        if ( (!weights.empty() && !open_output(weights_file, output_dir, unit_name + "_weights.ads", error)) ||
+             !open_output(spec_file, output_dir, unit_name + ".ads", error) ||
+             !open_output(body_file, output_dir, unit_name + ".adb", error) ||
+             !open_output(run_file, output_dir, unit_name + "_run.adb", error) )
+        {
+            std::cerr << error << std::endl;
+            return -5;
+        }
+        weights_os = &weights_file;
+        spec = &spec_file;
+        body = &body_file;
+        run = &run_file;
+    }
+
+    if ( weights == "ada" )
+    {
+        if ( blob.data.size() > weights_aggregate_warning_bytes )
+        {
+            std::cerr << "Weights of " << blob.data.size() << " bytes are written as an aggregate that is slow to compile;"
+                      << " consider --weights object" << std::endl;
+        }
+        write_weights_package(*weights_os, weights_package, blob);
+    }
+    else if ( weights == "object" )
+    {
+        if ( !write_weights_object(output_dir, weights_package, blob, error) )
+        {
+            std::cerr << error << std::endl;
+            return -5;
+        }
+        write_weights_import(*weights_os, weights_package, blob);
+    }
+
+    *spec << "-- " << graph.name << ".ads" << std::endl;
+    if ( !weights.empty() )
+    {
+        *spec << "with " << weights_package << ";" << std::endl;
+    }
+    *spec << "with Generic_Real_Arrays;" << std::endl;
+    *spec << "with Generic_Real_Arrays.Operators;" << std::endl;
+    *spec << "package " << graph.name << " is" << std::endl;
+    if ( !tasks && !instrument_runs )
+    {
+        *spec << "    pragma Preelaborate;" << std::endl;
+    }
+    *spec << "    package Real_Arrays is new Generic_Real_Arrays(Real => Float);" << std::endl;
+    *spec << "    package Operators is new Real_Arrays.Operators;" << std::endl;
+    *spec << "    use Real_Arrays;" << std::endl;
+    *spec << "    use Operators;" << std::endl;
+    for ( const auto& input : graph.inputs )
+    {
+        const auto& tensor = graph.tensors.at(input);
+        *spec << "    " << tensor_declaration(tensor) << std::endl;
+    }
+    for ( const auto& output : graph.outputs )
+    {
+        const auto& tensor = graph.tensors.at(output);
+        *spec << "    " << tensor_declaration(tensor) << std::endl;
+    }
+    for ( const auto& operation : graph.operations )
+    {
+        if ( operation.name != "variable" )
+        {
+            continue;
+        }
+        for ( const auto& output : operation.outputs )
+        {
+            const auto& id = output.second.identifier();
+            const auto& tensor = graph.tensors.at(id);
+            if ( !weights.empty() )
+            {
+                *spec << "    " << weights_declaration(tensor, weights_package, blob.offsets.at(id)) << std::endl;
+            }
+            else
+            {
+                *spec << "    " << tensor_declaration(tensor) << std::endl;
+            }
+        }
+    }
+    // With --workspace the intermediates are deliberately not visible in the spec: they overlay
+    // shared storage in the body and only hold their values while Forward computes them
+    if ( !workspace )
+    {
+        for ( const auto& id : intermediates )
+        {
+            *spec << "        " << tensor_declaration(graph.tensors.at(id)) << std::endl;
+        }
+    }
+    else
+    {
+        *spec << "    -- Intermediate tensors are private to the body, in a shared workspace" << std::endl;
+    }
+    *spec << "    procedure Forward;" << std::endl;
+    if ( instrument_runs )
+    {
+        *spec << "    procedure Reset_Profile;" << std::endl;
+        *spec << "    procedure Print_Profile (Runs: Positive);" << std::endl;
+    }
+    *spec << "end " << graph.name << ";" << std::endl;
+
+    // Intermediates in the workspace are local to Forward, unless Forward is split into blocks or tasks
+    const bool global_decl = block_size || tasks;
+    const std::string decl_indent = global_decl ? "    " : "        ";
+    *body << "-- " << graph.name << ".adb" << std::endl;
+    bool elementary_functions = false;
+    for ( const auto& group : fusion.groups )
+    {
+        for ( const auto& i : group.second )
+        {
+            elementary_functions |= elementwise.at(graph.operations[i].name).find("Elementary_Functions") != std::string::npos;
+        }
+    }
+    if ( elementary_functions )
+    {
+        *body << "with Ada.Numerics.Elementary_Functions;" << std::endl;
+    }
+    if ( instrument_runs )
+    {
+        *body << "with Ada.Real_Time;" << std::endl;
+        *body << "with Ada.Text_IO;" << std::endl;
+        *body << "with Ada.Float_Text_IO;" << std::endl;
+    }
+    if ( workspace )
+    {
+        *body << "with System.Storage_Elements;" << std::endl;
+    }
+    *body << "package body " << graph.name << " is" << std::endl;
+    if ( workspace )
+    {
+        *body << "    -- Workspace of " << plan.size << " bytes shared by " << intermediates.size() << " intermediate tensors ("
+              << plan.unshared_size << " bytes without reuse)" << std::endl;
+        *body << "    Workspace: System.Storage_Elements.Storage_Array (1.." << std::max<size_t>(plan.size, 1) << ")"
+              << " with Alignment => " << workspace_alignment << ";" << std::endl;
+        if ( global_decl )
+        {
+            for ( const auto& id : intermediates )
+            {
+                *body << decl_indent << workspace_declaration(graph.tensors.at(id), plan.offsets.at(id)) << std::endl;
+            }
+        }
+    }
+    if ( instrument_runs )
+    {
+        *body << "    use type Ada.Real_Time.Time, Ada.Real_Time.Time_Span;" << std::endl;
+        write_profile_table(*body, profile, tasks > 0);
+    }
+    if ( tasks )
+    {
+        write_task_pool(*body, graph, schedule, profile);
+    }
+    else if ( !block_size )
+    {
+        *body << "    procedure Forward is" << std::endl;
+        if ( workspace )
+        {
+            for ( const auto& id : intermediates )
+            {
+                *body << decl_indent << workspace_declaration(graph.tensors.at(id), plan.offsets.at(id)) << std::endl;
+            }
+        }
+        if ( instrument_runs )
+        {
+            *body << "        Profile_Start: Ada.Real_Time.Time;" << std::endl;
+        }
+        *body << "    begin" << std::endl;
+    }
+
+    std::ostringstream load;
+    std::set<std::string> external_types;
+    std::set<std::string> variable_types;
+    std::set<std::string> output_types;
+    size_t computations = 0;
+
+    for ( size_t i = 0; i < graph.operations.size(); ++i )
+    {
+        const auto& operation = graph.operations[i];
+	    if (operation.name == "external")
+	    {
+            for ( const auto& output : operation.outputs )
+            {
+                const auto& id = output.second.identifier();
+                const auto& tensor = graph.tensors.at(id);
+                load << "    " + operation.name + " (\"" + tensor.name + "\", " + tensor_id(tensor.name) + ");" << std::endl;
+                external_types.insert(tensor_typename(tensor));
+            }
+	    }
+	    else if (operation.name == "variable")
+	    {
+            if ( !weights.empty() )
+            {
+                continue;
+            }
+            for ( const auto& output : operation.outputs )
+            {
+                const auto& id = output.second.identifier();
+                const auto& tensor = graph.tensors.at(id);
+                const auto& label = operation.attribs.get("label");
+                load << "    " + operation.name + " (\"" + label.string() + "\", " + tensor_id(tensor.name) + ");" << std::endl;
+                variable_types.insert(tensor_typename(tensor));
+            }
+	    }
+        else
+        {
+            for ( const auto& output : operation.outputs )
+            {
+                const auto& id = output.second.identifier();
+                if ( graph_outputs.count(id) )
+                {
+                    output_types.insert(tensor_typename(graph.tensors.at(id)));
+                }
+            }
+            if ( tasks || (fuse && fusion.root[i] != i) )
+            {
+                continue;
+            }
+
+            if ( block_size && computations % block_size == 0 )
+            {
+                if ( computations )
+                {
+                    *body << "    end Forward_Block_" << computations / block_size << ";" << std::endl;
+                }
+                *body << "    procedure Forward_Block_" << computations / block_size + 1 << " is" << std::endl;
+                if ( instrument_runs )
+                {
+                    *body << "        Profile_Start: Ada.Real_Time.Time;" << std::endl;
+                }
+                *body << "    begin" << std::endl;
+            }
+            ++computations;
+
+            const size_t slot = instrument_runs ? profile.slot[i] : 0;
+            write_profile_start(*body, "        ", slot);
+            auto group = fusion.groups.find(i);
+            if ( group != fusion.groups.end() )
+            {
+                write_fused_loop(*body, graph, group->second, "        ");
+            }
+            else
+            {
+                *body << "        ";
+                write_operation_call(*body, graph, operation);
+                *body << std::endl;
+            }
+            write_profile_stop(*body, "        ", slot);
+        }
+    }
+
+    if ( block_size )
+    {
+        const size_t blocks = (computations + block_size - 1) / block_size;
+        if ( blocks )
+        {
+            *body << "    end Forward_Block_" << blocks << ";" << std::endl;
+        }
+        *body << "    procedure Forward is" << std::endl;
+        *body << "    begin" << std::endl;
+        for ( size_t block = 1; block <= blocks; ++block )
+        {
+            *body << "        Forward_Block_" << block << ";" << std::endl;
+        }
+        if ( !blocks )
+        {
+            *body << "        null;" << std::endl;
+        }
+    }
+    else if ( !computations && !tasks )
+    {
+        *body << "        null;" << std::endl;
+    }
+    *body << "    end Forward;" << std::endl;
+    if ( instrument_runs )
+    {
+        write_profile_report(*body, profile, tasks > 0);
+    }
+    *body << "end " << graph.name << ";" << std::endl;
+
+    *run << "-- " << graph.name << "_run.adb" << std::endl;
+    *run << "with " << graph.name << "; use " << graph.name << ";" << std::endl;
+    *run << "use " << graph.name << ".Real_Arrays;" << std::endl;
+    *run << "procedure " + graph.name + "_Run is" << std::endl;
+    for (auto type_name: external_types)
+    {
+        *run << "    procedure External (Var_Name: String; Tensor: out " + type_name + ") is" << std::endl;
+        *run << "    begin" << std::endl;
+        *run << "        null;" << std::endl;
+        *run << "    end External;" << std::endl;
+    }
+    for (auto type_name: variable_types)
+    {
+        *run << "    procedure Variable (Var_Name: String; Tensor: out " + type_name + ") is" << std::endl;
+        *run << "    begin" << std::endl;
+        *run << "        null;" << std::endl;
+        *run << "    end Variable;" << std::endl;
+    }
+    for (auto type_name: output_types)
+    {
+        *run << "    procedure Output (Tensor: " + type_name + "; Var_Name: String) is" << std::endl;
+        *run << "    begin" << std::endl;
+        *run << "        null;" << std::endl;
+        *run << "    end Output;" << std::endl;
+    }
+
+    *run << "begin" << std::endl;
+    *run << load.str();
+    *run << "    Forward;" << std::endl;
+    if ( instrument_runs )
+    {
+        *run << "    Reset_Profile;" << std::endl;
+        *run << "    for Run in 1.." << instrument_runs << " loop" << std::endl;
+        *run << "        Forward;" << std::endl;
+        *run << "    end loop;" << std::endl;
+        *run << "    Print_Profile (" << instrument_runs << ");" << std::endl;
+    }
+    for ( const auto& output : graph.outputs )
     {
         const auto& tensor = graph.tensors.at(output);
-        std::cout << "    Output (" + tensor_id(tensor.name) + ", \"" + tensor.name + "\");" << std::endl;
+        *run << "    Output (" + tensor_id(tensor.name) + ", \"" + tensor.name + "\");" << std::endl;
+    }
+    *run << "end " + graph.name + "_Run;" << std::endl;
+
+    if ( !output_dir.empty() && (!spec_file || !body_file || !run_file || (weights_file.is_open() && !weights_file)) )
+    {
+        std::cerr << "could not write output files to: " << output_dir << std::endl;
+        return -5;
     }
-    std::cout << "end " + graph.name + "_Run;" << std::endl;
     
     return 0;
 }
@@ -0,0 +1,1493 @@
+#include "nnef.h"
+#include "nnef_tools_common.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+// Kernels of the generated code; all extents, strides and attributes are template parameters,
+// so every loop has a trip count known at compile time; the output of an operation never shares
+// storage with its inputs, so all tensor pointers are __restrict
+const char* runtime_kernels = R"RUNTIME(
+namespace nnef_rt
+{
+    struct op_copy { template<class T> T operator()( T x ) const { return x; } };
+    struct op_neg { template<class T> T operator()( T x ) const { return -x; } };
+    struct op_rcp { float operator()( float x ) const { return 1.0f / x; } };
+    struct op_exp { float operator()( float x ) const { return std::exp(x); } };
+    struct op_log { float operator()( float x ) const { return std::log(x); } };
+    struct op_log2 { float operator()( float x ) const { return std::log2(x); } };
+    struct op_sin { float operator()( float x ) const { return std::sin(x); } };
+    struct op_cos { float operator()( float x ) const { return std::cos(x); } };
+    struct op_tan { float operator()( float x ) const { return std::tan(x); } };
+    struct op_tanh { float operator()( float x ) const { return std::tanh(x); } };
+    struct op_sigmoid { float operator()( float x ) const { return 1.0f / (1.0f + std::exp(-x)); } };
+    struct op_softplus { float operator()( float x ) const { return std::log(std::exp(x) + 1.0f); } };
+    struct op_abs { template<class T> T operator()( T x ) const { return x < T(0) ? -x : x; } };
+    struct op_sign { template<class T> T operator()( T x ) const { return T((T(0) < x) - (x < T(0))); } };
+    struct op_not { bool operator()( bool x ) const { return !x; } };
+    struct op_floor { float operator()( float x ) const { return std::floor(x); } };
+    struct op_ceil { float operator()( float x ) const { return std::ceil(x); } };
+    struct op_round { float operator()( float x ) const { return std::round(x); } };
+    struct op_sqr { template<class T> T operator()( T x ) const { return x * x; } };
+    struct op_sqrt { float operator()( float x ) const { return std::sqrt(x); } };
+    struct op_rsqrt { float operator()( float x ) const { return 1.0f / std::sqrt(x); } };
+    struct op_relu { template<class T> T operator()( T x ) const { return x > T(0) ? x : T(0); } };
+
+    struct op_add { template<class T> T operator()( T x, T y ) const { return x + y; } };
+    struct op_sub { template<class T> T operator()( T x, T y ) const { return x - y; } };
+    struct op_mul { template<class T> T operator()( T x, T y ) const { return x * y; } };
+    struct op_div { template<class T> T operator()( T x, T y ) const { return x / y; } };
+    struct op_pow { float operator()( float x, float y ) const { return std::pow(x, y); } };
+    struct op_min { template<class T> T operator()( T x, T y ) const { return y < x ? y : x; } };
+    struct op_max { template<class T> T operator()( T x, T y ) const { return x < y ? y : x; } };
+    struct op_lt { template<class T> bool operator()( T x, T y ) const { return x < y; } };
+    struct op_gt { template<class T> bool operator()( T x, T y ) const { return x > y; } };
+    struct op_le { template<class T> bool operator()( T x, T y ) const { return x <= y; } };
+    struct op_ge { template<class T> bool operator()( T x, T y ) const { return x >= y; } };
+    struct op_eq { template<class T> bool operator()( T x, T y ) const { return x == y; } };
+    struct op_ne { template<class T> bool operator()( T x, T y ) const { return x != y; } };
+    struct op_and { bool operator()( bool x, bool y ) const { return x && y; } };
+    struct op_or { bool operator()( bool x, bool y ) const { return x || y; } };
+
+    struct red_sum
+    {
+        template<class T> static T init() { return T(0); }
+        template<class T> static T combine( T x, T y ) { return x + y; }
+    };
+    struct red_max
+    {
+        template<class T> static T init() { return std::numeric_limits<T>::lowest(); }
+        template<class T> static T combine( T x, T y ) { return x < y ? y : x; }
+    };
+    struct red_min
+    {
+        template<class T> static T init() { return std::numeric_limits<T>::max(); }
+        template<class T> static T combine( T x, T y ) { return y < x ? y : x; }
+    };
+
+    // Row-major strides of an operand broadcast over extents D0..D3; bit 3-i of mask M is set
+    // if the operand varies along dimension i, otherwise its extent there is 1
+    template<size_t D1, size_t D2, size_t D3, unsigned M>
+    struct broadcast_strides
+    {
+        static constexpr size_t e1 = (M & 4) ? D1 : 1;
+        static constexpr size_t e2 = (M & 2) ? D2 : 1;
+        static constexpr size_t e3 = (M & 1) ? D3 : 1;
+        static constexpr size_t s3 = (M & 1) ? 1 : 0;
+        static constexpr size_t s2 = (M & 2) ? e3 : 0;
+        static constexpr size_t s1 = (M & 4) ? e2 * e3 : 0;
+        static constexpr size_t s0 = (M & 8) ? e1 * e2 * e3 : 0;
+    };
+
+    template<class Op, size_t N, class X, class Y>
+    inline void unary( const X* __restrict x, Y* __restrict y )
+    {
+        for ( size_t i = 0; i < N; ++i )
+        {
+            y[i] = Op()(x[i]);
+        }
+    }
+
+    template<class Op, size_t D0, size_t D1, size_t D2, size_t D3, unsigned MX, unsigned MY, class X, class Y, class Z>
+    inline void binary( const X* __restrict x, const Y* __restrict y, Z* __restrict z )
+    {
+        typedef broadcast_strides<D1, D2, D3, MX> sx;
+        typedef broadcast_strides<D1, D2, D3, MY> sy;
+        for ( size_t i0 = 0; i0 < D0; ++i0 )
+        for ( size_t i1 = 0; i1 < D1; ++i1 )
+        for ( size_t i2 = 0; i2 < D2; ++i2 )
+        {
+            const X* xr = x + i0 * sx::s0 + i1 * sx::s1 + i2 * sx::s2;
+            const Y* yr = y + i0 * sy::s0 + i1 * sy::s1 + i2 * sy::s2;
+            Z* zr = z + ((i0 * D1 + i1) * D2 + i2) * D3;
+            for ( size_t i3 = 0; i3 < D3; ++i3 )
+            {
+                zr[i3] = Op()(xr[i3 * sx::s3], yr[i3 * sy::s3]);
+            }
+        }
+    }
+
+    template<size_t D0, size_t D1, size_t D2, size_t D3, unsigned MC, unsigned MX, unsigned MY, class T>
+    inline void select( const bool* __restrict c, const T* __restrict x, const T* __restrict y, T* __restrict z )
+    {
+        typedef broadcast_strides<D1, D2, D3, MC> sc;
+        typedef broadcast_strides<D1, D2, D3, MX> sx;
+        typedef broadcast_strides<D1, D2, D3, MY> sy;
+        for ( size_t i0 = 0; i0 < D0; ++i0 )
+        for ( size_t i1 = 0; i1 < D1; ++i1 )
+        for ( size_t i2 = 0; i2 < D2; ++i2 )
+        {
+            const bool* cr = c + i0 * sc::s0 + i1 * sc::s1 + i2 * sc::s2;
+            const T* xr = x + i0 * sx::s0 + i1 * sx::s1 + i2 * sx::s2;
+            const T* yr = y + i0 * sy::s0 + i1 * sy::s1 + i2 * sy::s2;
+            T* zr = z + ((i0 * D1 + i1) * D2 + i2) * D3;
+            for ( size_t i3 = 0; i3 < D3; ++i3 )
+            {
+                zr[i3] = cr[i3 * sc::s3] ? xr[i3 * sx::s3] : yr[i3 * sy::s3];
+            }
+        }
+    }
+
+    // Copy of a strided view of x: y[i0, i1, i2, i3] = x[O + i0 * S0 + i1 * S1 + i2 * S2 + i3 * S3]
+    template<size_t D0, size_t D1, size_t D2, size_t D3, size_t S0, size_t S1, size_t S2, size_t S3, size_t O, class T>
+    inline void view_copy( const T* __restrict x, T* __restrict y )
+    {
+        for ( size_t i0 = 0; i0 < D0; ++i0 )
+        for ( size_t i1 = 0; i1 < D1; ++i1 )
+        for ( size_t i2 = 0; i2 < D2; ++i2 )
+        {
+            const T* xr = x + O + i0 * S0 + i1 * S1 + i2 * S2;
+            T* yr = y + ((i0 * D1 + i1) * D2 + i2) * D3;
+            for ( size_t i3 = 0; i3 < D3; ++i3 )
+            {
+                yr[i3] = xr[i3 * S3];
+            }
+        }
+    }
+
+    // Copy of Outer blocks of Part items between arrays whose blocks start XStride and YStride items apart
+    template<size_t Outer, size_t Part, size_t XStride, size_t YStride, class T>
+    inline void block_copy( const T* __restrict x, T* __restrict y )
+    {
+        for ( size_t o = 0; o < Outer; ++o )
+        {
+            std::copy(x + o * XStride, x + o * XStride + Part, y + o * YStride);
+        }
+    }
+
+    // Reduction of x viewed as [Outer, R, Inner] over the middle dimension
+    template<class Red, size_t Outer, size_t R, size_t Inner, bool Mean, class T>
+    inline void reduce( const T* __restrict x, T* __restrict y )
+    {
+        for ( size_t o = 0; o < Outer; ++o )
+        {
+            T* yr = y + o * Inner;
+            for ( size_t i = 0; i < Inner; ++i )
+            {
+                yr[i] = Red::template init<T>();
+            }
+            for ( size_t r = 0; r < R; ++r )
+            {
+                const T* xr = x + (o * R + r) * Inner;
+                for ( size_t i = 0; i < Inner; ++i )
+                {
+                    yr[i] = Red::combine(yr[i], xr[i]);
+                }
+            }
+            if ( Mean )
+            {
+                for ( size_t i = 0; i < Inner; ++i )
+                {
+                    yr[i] /= T(R);
+                }
+            }
+        }
+    }
+
+    template<size_t Outer, size_t R, size_t Inner>
+    inline void softmax( const float* __restrict x, float* __restrict y )
+    {
+        for ( size_t o = 0; o < Outer; ++o )
+        for ( size_t i = 0; i < Inner; ++i )
+        {
+            const float* xr = x + o * R * Inner + i;
+            float* yr = y + o * R * Inner + i;
+            float m = xr[0];
+            for ( size_t r = 1; r < R; ++r )
+            {
+                m = std::max(m, xr[r * Inner]);
+            }
+            float s = 0.0f;
+            for ( size_t r = 0; r < R; ++r )
+            {
+                yr[r * Inner] = std::exp(xr[r * Inner] - m);
+                s += yr[r * Inner];
+            }
+            for ( size_t r = 0; r < R; ++r )
+            {
+                yr[r * Inner] /= s;
+            }
+        }
+    }
+
+    // 2D convolution of [N, C, H, W] by [O, C/G, KH, KW] with B bias values (1 or O); the innermost
+    // loop runs over the output columns whose input column is inside the image
+    template<size_t N, size_t C, size_t H, size_t W, size_t O, size_t KH, size_t KW, size_t OH, size_t OW,
+             size_t SH, size_t SW, size_t DH, size_t DW, size_t PH, size_t PW, size_t G, size_t B>
+    inline void conv( const float* __restrict x, const float* __restrict f, const float* __restrict b, float* __restrict y )
+    {
+        constexpr size_t CG = C / G;
+        constexpr size_t OG = O / G;
+        for ( size_t n = 0; n < N; ++n )
+        for ( size_t o = 0; o < O; ++o )
+        {
+            float* yo = y + (n * O + o) * OH * OW;
+            const float bias = b[B == 1 ? 0 : o];
+            for ( size_t i = 0; i < OH * OW; ++i )
+            {
+                yo[i] = bias;
+            }
+            const size_t g = o / OG;
+            for ( size_t c = 0; c < CG; ++c )
+            {
+                const float* xc = x + (n * C + g * CG + c) * H * W;
+                const float* fc = f + (o * CG + c) * KH * KW;
+                for ( size_t kh = 0; kh < KH; ++kh )
+                for ( size_t kw = 0; kw < KW; ++kw )
+                {
+                    const float w = fc[kh * KW + kw];
+                    const ptrdiff_t off = (ptrdiff_t)(kw * DW) - (ptrdiff_t)PW;
+                    const size_t ow_begin = off < 0 ? (size_t)((-off + (ptrdiff_t)SW - 1) / (ptrdiff_t)SW) : 0;
+                    const size_t ow_end = (ptrdiff_t)W > off ? std::min(OW, (size_t)(((ptrdiff_t)W - off + (ptrdiff_t)SW - 1) / (ptrdiff_t)SW)) : 0;
+                    for ( size_t oh = 0; oh < OH; ++oh )
+                    {
+                        const ptrdiff_t ih = (ptrdiff_t)(oh * SH + kh * DH) - (ptrdiff_t)PH;
+                        if ( ih < 0 || ih >= (ptrdiff_t)H )
+                        {
+                            continue;
+                        }
+                        const float* xr = xc + ih * W;
+                        float* yr = yo + oh * OW;
+                        for ( size_t ow = ow_begin; ow < ow_end; ++ow )
+                        {
+                            yr[ow] += w * xr[(ptrdiff_t)(ow * SW) + off];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // 2D pooling of NC planes; with Ignore, padded items are left out (and not counted for
+    // the average), otherwise they are zeros
+    template<class Red, bool Average, bool Ignore, size_t NC, size_t H, size_t W, size_t OH, size_t OW, size_t KH, size_t KW,
+             size_t SH, size_t SW, size_t DH, size_t DW, size_t PH, size_t PW>
+    inline void pool( const float* __restrict x, float* __restrict y )
+    {
+        for ( size_t p = 0; p < NC; ++p )
+        for ( size_t oh = 0; oh < OH; ++oh )
+        for ( size_t ow = 0; ow < OW; ++ow )
+        {
+            float acc = Red::template init<float>();
+            size_t count = 0;
+            for ( size_t kh = 0; kh < KH; ++kh )
+            for ( size_t kw = 0; kw < KW; ++kw )
+            {
+                const ptrdiff_t ih = (ptrdiff_t)(oh * SH + kh * DH) - (ptrdiff_t)PH;
+                const ptrdiff_t iw = (ptrdiff_t)(ow * SW + kw * DW) - (ptrdiff_t)PW;
+                if ( ih < 0 || ih >= (ptrdiff_t)H || iw < 0 || iw >= (ptrdiff_t)W )
+                {
+                    if ( !Ignore )
+                    {
+                        acc = Red::combine(acc, 0.0f);
+                    }
+                    continue;
+                }
+                acc = Red::combine(acc, x[(p * H + ih) * W + iw]);
+                ++count;
+            }
+            y[(p * OH + oh) * OW + ow] = Average ? acc / (Ignore ? (float)count : (float)(KH * KW)) : acc;
+        }
+    }
+
+    // [M, K] x [N, K]^T + bias of B values (1 or N)
+    template<size_t M, size_t K, size_t N, size_t B>
+    inline void linear( const float* __restrict x, const float* __restrict f, const float* __restrict b, float* __restrict y )
+    {
+        for ( size_t m = 0; m < M; ++m )
+        for ( size_t n = 0; n < N; ++n )
+        {
+            const float* xr = x + m * K;
+            const float* fr = f + n * K;
+            float acc = 0.0f;
+            for ( size_t k = 0; k < K; ++k )
+            {
+                acc += xr[k] * fr[k];
+            }
+            y[m * N + n] = acc + b[B == 1 ? 0 : n];
+        }
+    }
+
+    // Batches of [M, K] x [K, N], with either operand stored transposed
+    template<size_t Batch, size_t M, size_t N, size_t K, bool TA, bool TB>
+    inline void matmul( const float* __restrict a, const float* __restrict b, float* __restrict y )
+    {
+        for ( size_t i = 0; i < Batch; ++i )
+        {
+            const float* ai = a + i * M * K;
+            const float* bi = b + i * K * N;
+            float* yi = y + i * M * N;
+            for ( size_t m = 0; m < M; ++m )
+            {
+                float* yr = yi + m * N;
+                if ( TB )
+                {
+                    for ( size_t n = 0; n < N; ++n )
+                    {
+                        float acc = 0.0f;
+                        for ( size_t k = 0; k < K; ++k )
+                        {
+                            acc += ai[TA ? k * M + m : m * K + k] * bi[n * K + k];
+                        }
+                        yr[n] = acc;
+                    }
+                }
+                else
+                {
+                    for ( size_t n = 0; n < N; ++n )
+                    {
+                        yr[n] = 0.0f;
+                    }
+                    for ( size_t k = 0; k < K; ++k )
+                    {
+                        const float s = ai[TA ? k * M + m : m * K + k];
+                        const float* br = bi + k * N;
+                        for ( size_t n = 0; n < N; ++n )
+                        {
+                            yr[n] += s * br[n];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+)RUNTIME";
+
+// Reading and writing NNEF tensor files in the generated benchmark
+const char* runtime_io = R"RUNTIME(
+namespace nnef_rt
+{
+    template<class T> struct item_code;
+    template<> struct item_code<float> { static constexpr unsigned type = 0, bits = 32; };
+    template<> struct item_code<int> { static constexpr unsigned type = 4, bits = 32; };
+    template<> struct item_code<bool> { static constexpr unsigned type = 5, bits = 1; };
+
+    inline unsigned read_u32( const unsigned char* p )
+    {
+        return (unsigned)p[0] | (unsigned)p[1] << 8 | (unsigned)p[2] << 16 | (unsigned)p[3] << 24;
+    }
+
+    inline void write_u32( unsigned char* p, unsigned value )
+    {
+        for ( size_t i = 0; i < 4; ++i )
+        {
+            p[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+
+    template<class T>
+    bool read_tensor( const char* path, T* data, const unsigned* shape, size_t rank )
+    {
+        FILE* file = std::fopen(path, "rb");
+        if ( !file )
+        {
+            return false;
+        }
+        unsigned char header[128];
+        size_t count = 1;
+        bool ok = std::fread(header, 1, 128, file) == 128 && header[0] == 0x4E && header[1] == 0xEF &&
+                  read_u32(header + 8) == rank && read_u32(header + 44) == item_code<T>::bits && read_u32(header + 48) == item_code<T>::type;
+        for ( size_t i = 0; ok && i < rank; ++i )
+        {
+            ok = read_u32(header + 12 + 4 * i) == shape[i];
+            count *= shape[i];
+        }
+        std::vector<unsigned char> bytes((count * item_code<T>::bits + 7) / 8);
+        ok = ok && read_u32(header + 4) == bytes.size() && std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        std::fclose(file);
+        if ( ok && item_code<T>::bits == 1 )
+        {
+            for ( size_t i = 0; i < count; ++i )
+            {
+                data[i] = (bytes[i / 8] >> (7 - i % 8)) & 1;
+            }
+        }
+        else if ( ok )
+        {
+            std::memcpy(data, bytes.data(), bytes.size());
+        }
+        return ok;
+    }
+
+    template<class T>
+    bool write_tensor( const char* path, const T* data, const unsigned* shape, size_t rank )
+    {
+        unsigned char header[128] = { 0x4E, 0xEF, 1, 0 };
+        size_t count = 1;
+        for ( size_t i = 0; i < rank; ++i )
+        {
+            write_u32(header + 12 + 4 * i, shape[i]);
+            count *= shape[i];
+        }
+        std::vector<unsigned char> bytes((count * item_code<T>::bits + 7) / 8);
+        if ( item_code<T>::bits == 1 )
+        {
+            for ( size_t i = 0; i < count; ++i )
+            {
+                bytes[i / 8] |= (unsigned char)(data[i] ? 0x80 >> (i % 8) : 0);
+            }
+        }
+        else
+        {
+            std::memcpy(bytes.data(), data, bytes.size());
+        }
+        write_u32(header + 4, (unsigned)bytes.size());
+        write_u32(header + 8, (unsigned)rank);
+        write_u32(header + 44, item_code<T>::bits);
+        write_u32(header + 48, item_code<T>::type);
+
+        FILE* file = std::fopen(path, "wb");
+        if ( !file )
+        {
+            return false;
+        }
+        const bool ok = std::fwrite(header, 1, 128, file) == 128 && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        return std::fclose(file) == 0 && ok;
+    }
+}
+)RUNTIME";
+
+std::string cpp_type( const std::string& dtype )
+{
+    if ( dtype == "scalar" )
+    {
+        return "float";
+    }
+    else if ( dtype == "integer" )
+    {
+        return "int";
+    }
+    else if ( dtype == "logical" )
+    {
+        return "bool";
+    }
+    return dtype;
+}
+
+std::string cpp_id( const std::string& id )
+{
+    return "t_" + id;
+}
+
+size_t volume( const std::vector<int>& shape )
+{
+    size_t count = 1;
+    for ( const auto& extent : shape )
+    {
+        count *= extent;
+    }
+    return count;
+}
+
+std::string shape_list( const std::vector<int>& shape )
+{
+    std::ostringstream os;
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        os << (i ? ", " : "") << shape[i];
+    }
+    return os.str();
+}
+
+const size_t arena_alignment = 64;
+
+size_t element_size( const std::string& dtype )
+{
+    return dtype == "logical" ? sizeof(bool) : 4;    // bool, float or int
+}
+
+size_t tensor_bytes( const nnef::Tensor& tensor )
+{
+    const size_t size = element_size(tensor.dtype) * volume(tensor.shape);
+    return (size + arena_alignment - 1) / arena_alignment * arena_alignment;
+}
+
+// C++ literal of one item; float literals keep 9 significant digits, which round-trips
+std::string item_literal( const std::string& dtype, const double value )
+{
+    if ( dtype == "logical" )
+    {
+        return value != 0 ? "true" : "false";
+    }
+    if ( dtype == "integer" )
+    {
+        return std::to_string((long long)value);
+    }
+    if ( std::isnan(value) )
+    {
+        return "std::numeric_limits<float>::quiet_NaN()";
+    }
+    if ( std::isinf(value) )
+    {
+        return value < 0 ? "-std::numeric_limits<float>::infinity()" : "std::numeric_limits<float>::infinity()";
+    }
+    std::ostringstream os;
+    os << std::setprecision(9) << value;
+    std::string literal = os.str();
+    if ( literal.find_first_of(".e") == std::string::npos )
+    {
+        literal += ".0";
+    }
+    return literal + "f";
+}
+
+double value_item( const nnef::Value& value )
+{
+    switch ( value.kind() )
+    {
+        case nnef::Value::Kind::Scalar:
+            return value.scalar();
+        case nnef::Value::Kind::Integer:
+            return value.integer();
+        case nnef::Value::Kind::Logical:
+            return value.logical() ? 1 : 0;
+        default:
+            return 0;
+    }
+}
+
+double data_item( const nnef::Tensor& tensor, const size_t i )
+{
+    if ( tensor.dtype == "scalar" )
+    {
+        return reinterpret_cast<const float*>(tensor.data.data())[i];
+    }
+    else if ( tensor.dtype == "integer" )
+    {
+        return reinterpret_cast<const int*>(tensor.data.data())[i];
+    }
+    return reinterpret_cast<const bool*>(tensor.data.data())[i];
+}
+
+void write_array( std::ostream& os, const std::string& qualifiers, const std::string& dtype, const std::string& name,
+                  const size_t count, const std::function<double( size_t )>& item )
+{
+    os << "    alignas(" << arena_alignment << ") " << qualifiers << cpp_type(dtype) << " " << name << "[" << std::max<size_t>(count, 1) << "] =";
+    if ( count <= 8 )
+    {
+        os << " {";
+        for ( size_t i = 0; i < count; ++i )
+        {
+            os << (i ? ", " : " ") << item_literal(dtype, item(i));
+        }
+        os << " };" << std::endl;
+        return;
+    }
+    os << std::endl << "    {" << std::endl;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        os << (i % 8 == 0 ? "        " : " ") << item_literal(dtype, item(i)) << (i + 1 < count ? "," : "");
+        if ( i % 8 == 7 || i + 1 == count )
+        {
+            os << std::endl;
+        }
+    }
+    os << "    };" << std::endl;
+}
+
+// Literal operands of operations are emitted as one-item constant arrays
+struct literal_pool
+{
+    std::ostringstream declarations;
+    size_t count = 0;
+
+    std::string add( const std::string& dtype, const double value )
+    {
+        const std::string name = "l_" + std::to_string(++count);
+        declarations << "    static const " << cpp_type(dtype) << " " << name << "[1] = { " << item_literal(dtype, value) << " };" << std::endl;
+        return name;
+    }
+};
+
+struct operand
+{
+    std::string pointer;
+    std::vector<int> shape;    // empty for literals
+};
+
+operand make_operand( const nnef::Graph& graph, const nnef::Value& value, const std::string& dtype, literal_pool& literals )
+{
+    operand result;
+    if ( value.kind() == nnef::Value::Kind::Identifier )
+    {
+        result.pointer = cpp_id(value.identifier());
+        result.shape = graph.tensors.at(value.identifier()).shape;
+    }
+    else
+    {
+        result.pointer = literals.add(dtype, value_item(value));
+    }
+    return result;
+}
+
+const nnef::Tensor& output_tensor( const nnef::Graph& graph, const nnef::Operation& operation, const size_t i = 0 )
+{
+    return graph.tensors.at(operation.outputs[i].second.identifier());
+}
+
+const nnef::Tensor* input_tensor( const nnef::Graph& graph, const nnef::Operation& operation, const size_t i )
+{
+    const auto& value = operation.inputs[i].second;
+    return value.kind() == nnef::Value::Kind::Identifier ? &graph.tensors.at(value.identifier()) : nullptr;
+}
+
+std::vector<int> int_list( const nnef::Value& value )
+{
+    std::vector<int> items;
+    for ( size_t i = 0; i < value.size(); ++i )
+    {
+        items.push_back(value[i].integer());
+    }
+    return items;
+}
+
+// Elementwise operands broadcast NNEF style (missing trailing dimensions are singletons) are
+// described as masks over at most 4 dimensions of the output; dimensions along which all
+// operands behave the same are merged, so equal shapes become one flat loop
+bool broadcast_layout( const std::vector<int>& shape, const std::vector<operand>& operands,
+                       std::vector<size_t>& extents, std::vector<unsigned>& masks, std::string& error )
+{
+    std::vector<size_t> dims;
+    std::vector<std::vector<bool>> varies(operands.size());
+    for ( size_t d = 0; d < shape.size(); ++d )
+    {
+        if ( shape[d] == 1 )
+        {
+            continue;
+        }
+        std::vector<bool> pattern;
+        for ( const auto& op : operands )
+        {
+            pattern.push_back(d < op.shape.size() && op.shape[d] != 1);
+        }
+        bool same = !dims.empty();
+        for ( size_t k = 0; same && k < operands.size(); ++k )
+        {
+            same = varies[k].back() == pattern[k];
+        }
+        if ( same )
+        {
+            dims.back() *= shape[d];
+        }
+        else
+        {
+            dims.push_back(shape[d]);
+            for ( size_t k = 0; k < operands.size(); ++k )
+            {
+                varies[k].push_back(pattern[k]);
+            }
+        }
+    }
+    if ( dims.size() > 4 )
+    {
+        error = "broadcast over more than 4 independent dimensions is not supported";
+        return false;
+    }
+    const size_t pad = 4 - dims.size();
+    extents.assign(pad, 1);
+    extents.insert(extents.end(), dims.begin(), dims.end());
+    masks.assign(operands.size(), 0);
+    for ( size_t k = 0; k < operands.size(); ++k )
+    {
+        for ( size_t d = 0; d < dims.size(); ++d )
+        {
+            if ( varies[k][d] )
+            {
+                masks[k] |= 1u << (3 - pad - d);
+            }
+        }
+    }
+    return true;
+}
+
+// Strided view of a tensor as at most 4 dimensions; dimensions of extent 1 are dropped and
+// dimensions contiguous in the source are merged
+bool view_layout( const std::vector<int>& shape, const std::vector<size_t>& strides,
+                  std::vector<size_t>& extents, std::vector<size_t>& steps, std::string& error )
+{
+    std::vector<size_t> dims, dim_steps;
+    for ( size_t d = 0; d < shape.size(); ++d )
+    {
+        if ( shape[d] == 1 )
+        {
+            continue;
+        }
+        if ( !dims.empty() && dim_steps.back() == strides[d] * shape[d] )
+        {
+            dims.back() *= shape[d];
+            dim_steps.back() = strides[d];
+        }
+        else
+        {
+            dims.push_back(shape[d]);
+            dim_steps.push_back(strides[d]);
+        }
+    }
+    if ( dims.size() > 4 )
+    {
+        error = "views of more than 4 independent dimensions are not supported";
+        return false;
+    }
+    extents.assign(4 - dims.size(), 1);
+    steps.assign(4 - dims.size(), 0);
+    extents.insert(extents.end(), dims.begin(), dims.end());
+    steps.insert(steps.end(), dim_steps.begin(), dim_steps.end());
+    return true;
+}
+
+std::vector<size_t> row_major_strides( const std::vector<int>& shape )
+{
+    std::vector<size_t> strides(shape.size(), 1);
+    for ( size_t d = shape.size(); d-- > 1; )
+    {
+        strides[d - 1] = strides[d] * shape[d];
+    }
+    return strides;
+}
+
+// Tensor viewed as [Outer, R, Inner] where R spans the given axes; dimensions of extent 1
+// are ignored, the remaining reduced ones must be adjacent
+bool reduce_layout( const std::vector<int>& shape, const std::vector<int>& axes, size_t& outer, size_t& reduced, size_t& inner, std::string& error )
+{
+    outer = reduced = inner = 1;
+    int state = 0;    // 0: before, 1: inside, 2: after the reduced dimensions
+    for ( size_t d = 0; d < shape.size(); ++d )
+    {
+        if ( shape[d] == 1 )
+        {
+            continue;
+        }
+        const bool axis = std::find(axes.begin(), axes.end(), (int)d) != axes.end();
+        if ( axis && state == 2 )
+        {
+            error = "reduction over non-adjacent axes is not supported";
+            return false;
+        }
+        state = axis ? 1 : state == 1 ? 2 : state;
+        (state == 0 ? outer : state == 1 ? reduced : inner) *= shape[d];
+    }
+    return true;
+}
+
+bool write_elementwise( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, literal_pool& literals, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    std::string dtype = operation.name == "and" || operation.name == "or" || operation.name == "not" ? "logical" : "scalar";
+    for ( size_t i = operation.name == "select" ? 1 : 0; i < operation.inputs.size(); ++i )
+    {
+        if ( auto tensor = input_tensor(graph, operation, i) )
+        {
+            dtype = tensor->dtype;
+        }
+    }
+
+    std::vector<operand> operands;
+    for ( size_t i = 0; i < operation.inputs.size(); ++i )
+    {
+        operands.push_back(make_operand(graph, operation.inputs[i].second, operation.name == "select" && i == 0 ? "logical" : dtype, literals));
+    }
+    const std::string y = cpp_id(output.name);
+
+    if ( operands.size() == 1 )
+    {
+        if ( operands[0].shape.empty() )
+        {
+            error = "operation '" + operation.name + "' producing '" + output.name + "': literal operand is not supported";
+            return false;
+        }
+        os << "        nnef_rt::unary<nnef_rt::op_" << operation.name << ", " << volume(output.shape) << ">("
+           << operands[0].pointer << ", " << y << ");" << std::endl;
+        return true;
+    }
+
+    std::vector<size_t> extents;
+    std::vector<unsigned> masks;
+    if ( !broadcast_layout(output.shape, operands, extents, masks, error) )
+    {
+        error = "operation '" + operation.name + "' producing '" + output.name + "': " + error;
+        return false;
+    }
+    if ( operation.name == "select" )
+    {
+        os << "        nnef_rt::select<";
+    }
+    else
+    {
+        os << "        nnef_rt::binary<nnef_rt::op_" << operation.name << ", ";
+    }
+    for ( const auto& extent : extents )
+    {
+        os << extent << ", ";
+    }
+    for ( size_t k = 0; k < masks.size(); ++k )
+    {
+        os << masks[k] << (k + 1 < masks.size() ? ", " : ">(");
+    }
+    for ( const auto& op : operands )
+    {
+        os << op.pointer << ", ";
+    }
+    os << y << ");" << std::endl;
+    return true;
+}
+
+// Spatial attributes of a convolution or pooling over the trailing dimensions; empty
+// padding is computed as NNEF auto padding
+void spatial_attributes( const nnef::Operation& operation, const std::vector<int>& input, const std::vector<int>& output,
+                         const std::vector<int>& size, std::vector<int>& stride, std::vector<int>& dilation, std::vector<int>& padding )
+{
+    const size_t rank = size.size();
+    stride = int_list(operation.attribs.get("stride"));
+    dilation = int_list(operation.attribs.get("dilation"));
+    stride.resize(rank, 1);
+    dilation.resize(rank, 1);
+    const auto& pads = operation.attribs.get("padding");
+    padding.assign(rank, 0);
+    for ( size_t d = 0; d < rank; ++d )
+    {
+        if ( pads.size() )
+        {
+            padding[d] = pads[d][0].integer();
+        }
+        else
+        {
+            const int offset = input.size() - rank;
+            const int total = (output[offset + d] - 1) * stride[d] + (size[d] - 1) * dilation[d] + 1 - input[offset + d];
+            padding[d] = std::max(total, 0) / 2;
+        }
+    }
+}
+
+bool write_conv( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, literal_pool& literals, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto input = input_tensor(graph, operation, 0);
+    const auto filter = input_tensor(graph, operation, 1);
+    const auto& border = operation.attribs.get("border");
+    if ( !input || !filter || (input->shape.size() != 3 && input->shape.size() != 4) ||
+         (border.kind() == nnef::Value::Kind::String && border.string() != "constant") )
+    {
+        error = "conv producing '" + output.name + "': only 1D and 2D convolution with constant border is supported";
+        return false;
+    }
+    // 1D convolution runs as 2D with a single row
+    auto x = input->shape, f = filter->shape, y = output.shape;
+    if ( x.size() == 3 )
+    {
+        x.insert(x.begin() + 2, 1);
+        f.insert(f.begin() + 2, 1);
+        y.insert(y.begin() + 2, 1);
+    }
+    std::vector<int> stride, dilation, padding;
+    spatial_attributes(operation, input->shape, output.shape, std::vector<int>(filter->shape.begin() + 2, filter->shape.end()), stride, dilation, padding);
+    if ( input->shape.size() == 3 )
+    {
+        stride.insert(stride.begin(), 1);
+        dilation.insert(dilation.begin(), 1);
+        padding.insert(padding.begin(), 0);
+    }
+    const int groups = operation.attribs.get("groups").integer();
+
+    const auto bias = make_operand(graph, operation.inputs[2].second, "scalar", literals);
+    os << "        nnef_rt::conv<" << x[0] << ", " << x[1] << ", " << x[2] << ", " << x[3] << ", "
+       << f[0] << ", " << f[2] << ", " << f[3] << ", " << y[2] << ", " << y[3] << ", "
+       << stride[0] << ", " << stride[1] << ", " << dilation[0] << ", " << dilation[1] << ", "
+       << padding[0] << ", " << padding[1] << ", " << (groups == 0 ? x[1] : groups) << ", " << std::max<size_t>(volume(bias.shape), 1) << ">("
+       << cpp_id(input->name) << ", " << cpp_id(filter->name) << ", " << bias.pointer << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+bool write_pool( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto input = input_tensor(graph, operation, 0);
+    auto size = int_list(operation.attribs.get("size"));
+    const auto& border = operation.attribs.get("border").string();
+    const size_t rank = input ? input->shape.size() : 0;
+    bool supported = (rank == 3 || rank == 4) && size.size() == rank && (border == "ignore" || border == "constant");
+
+    std::vector<int> stride, dilation, padding;
+    if ( supported )
+    {
+        spatial_attributes(operation, input->shape, output.shape, size, stride, dilation, padding);
+        for ( size_t d = 0; d < 2; ++d )
+        {
+            supported &= size[d] == 1 && stride[d] == 1 && dilation[d] == 1 && padding[d] == 0;
+        }
+    }
+    if ( !supported )
+    {
+        error = operation.name + " producing '" + output.name + "': only pooling over the 1 or 2 trailing dimensions with ignore or constant border is supported";
+        return false;
+    }
+    auto x = input->shape, y = output.shape;
+    if ( rank == 3 )
+    {
+        x.insert(x.begin() + 2, 1);
+        y.insert(y.begin() + 2, 1);
+        size.insert(size.begin() + 2, 1);
+        stride.insert(stride.begin() + 2, 1);
+        dilation.insert(dilation.begin() + 2, 1);
+        padding.insert(padding.begin() + 2, 0);
+    }
+
+    const char* reduction = operation.name == "max_pool" ? "nnef_rt::red_max" : "nnef_rt::red_sum";
+    const bool average = operation.name == "avg_pool" || (operation.name == "box" && operation.attribs.get("normalize").logical());
+    os << "        nnef_rt::pool<" << reduction << ", " << (average ? "true" : "false") << ", "
+       << (border == "ignore" ? "true" : "false") << ", " << x[0] * x[1] << ", " << x[2] << ", " << x[3] << ", " << y[2] << ", " << y[3] << ", "
+       << size[2] << ", " << size[3] << ", " << stride[2] << ", " << stride[3] << ", " << dilation[2] << ", " << dilation[3] << ", "
+       << padding[2] << ", " << padding[3] << ">(" << cpp_id(input->name) << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+bool write_linear( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, literal_pool& literals, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto input = input_tensor(graph, operation, 0);
+    const auto filter = input_tensor(graph, operation, 1);
+    if ( !input || !filter || input->shape.size() != 2 || filter->shape.size() != 2 )
+    {
+        error = "linear producing '" + output.name + "': only matrix operands are supported";
+        return false;
+    }
+    const auto bias = make_operand(graph, operation.inputs[2].second, "scalar", literals);
+    os << "        nnef_rt::linear<" << input->shape[0] << ", " << input->shape[1] << ", " << filter->shape[0] << ", " << std::max<size_t>(volume(bias.shape), 1) << ">("
+       << cpp_id(input->name) << ", " << cpp_id(filter->name) << ", " << bias.pointer << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+bool write_matmul( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto a = input_tensor(graph, operation, 0);
+    const auto b = input_tensor(graph, operation, 1);
+    const bool ta = operation.attribs.get("transposeA").logical();
+    const bool tb = operation.attribs.get("transposeB").logical();
+    const size_t rank = output.shape.size();
+    bool supported = a && b && rank >= 2 && a->shape.size() == rank && b->shape.size() == rank;
+    for ( size_t d = 0; supported && d + 2 < rank; ++d )
+    {
+        supported = a->shape[d] == output.shape[d] && b->shape[d] == output.shape[d];
+    }
+    if ( !supported )
+    {
+        error = "matmul producing '" + output.name + "': only operands of equal batch dimensions are supported";
+        return false;
+    }
+    const size_t m = output.shape[rank - 2], n = output.shape[rank - 1];
+    const size_t k = a->shape[ta ? rank - 2 : rank - 1];
+    os << "        nnef_rt::matmul<" << volume(output.shape) / (m * n) << ", " << m << ", " << n << ", " << k << ", "
+       << (ta ? "true" : "false") << ", " << (tb ? "true" : "false") << ">("
+       << cpp_id(a->name) << ", " << cpp_id(b->name) << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+bool write_view_copy( std::ostream& os, const nnef::Tensor& input, const nnef::Tensor& output,
+                      const std::vector<size_t>& strides, const size_t offset, std::string& error )
+{
+    std::vector<size_t> extents, steps;
+    if ( !view_layout(output.shape, strides, extents, steps, error) )
+    {
+        error = "'" + output.name + "': " + error;
+        return false;
+    }
+    if ( offset == 0 && extents[0] * extents[1] * extents[2] == 1 && steps[3] == 1 )
+    {
+        os << "        nnef_rt::unary<nnef_rt::op_copy, " << volume(output.shape) << ">(" << cpp_id(input.name) << ", " << cpp_id(output.name) << ");" << std::endl;
+        return true;
+    }
+    os << "        nnef_rt::view_copy<";
+    for ( const auto& extent : extents )
+    {
+        os << extent << ", ";
+    }
+    for ( const auto& step : steps )
+    {
+        os << step << ", ";
+    }
+    os << offset << ">(" << cpp_id(input.name) << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+bool write_transpose( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto& input = *input_tensor(graph, operation, 0);
+    auto axes = int_list(operation.attribs.get("axes"));
+    for ( size_t d = axes.size(); d < input.shape.size(); ++d )
+    {
+        axes.push_back((int)d);
+    }
+    const auto source = row_major_strides(input.shape);
+    std::vector<size_t> strides;
+    for ( size_t d = 0; d < output.shape.size(); ++d )
+    {
+        strides.push_back(source[axes[d]]);
+    }
+    return write_view_copy(os, input, output, strides, 0, error);
+}
+
+bool write_slice( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto& input = *input_tensor(graph, operation, 0);
+    const auto axes = int_list(operation.attribs.get("axes"));
+    const auto begin = int_list(operation.attribs.get("begin"));
+    const auto step = int_list(operation.attribs.get("stride"));
+    auto strides = row_major_strides(input.shape);
+    size_t offset = 0;
+    for ( size_t i = 0; i < axes.size(); ++i )
+    {
+        const int extent = input.shape[axes[i]];
+        const int stride = i < step.size() ? step[i] : 1;
+        if ( stride <= 0 )
+        {
+            error = "slice producing '" + output.name + "': only positive strides are supported";
+            return false;
+        }
+        const int first = std::min(std::max(begin[i] < 0 ? begin[i] + extent : begin[i], 0), extent);
+        offset += first * strides[axes[i]];
+        strides[axes[i]] *= stride;
+    }
+    return write_view_copy(os, input, output, strides, offset, error);
+}
+
+bool write_concat( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, const bool split )
+{
+    const size_t axis = operation.attribs.get("axis").integer();
+    const auto& whole = split ? *input_tensor(graph, operation, 0) : output_tensor(graph, operation);
+    const auto& parts = split ? operation.outputs[0].second : operation.inputs[0].second;
+    const size_t outer = volume(std::vector<int>(whole.shape.begin(), whole.shape.begin() + axis));
+    const size_t total = volume(std::vector<int>(whole.shape.begin() + axis, whole.shape.end()));
+    size_t offset = 0;
+    for ( size_t i = 0; i < parts.size(); ++i )
+    {
+        const auto& part = graph.tensors.at(parts[i].identifier());
+        const size_t size = volume(std::vector<int>(part.shape.begin() + axis, part.shape.end()));
+        if ( split )
+        {
+            os << "        nnef_rt::block_copy<" << outer << ", " << size << ", " << total << ", " << size << ">("
+               << cpp_id(whole.name) << " + " << offset << ", " << cpp_id(part.name) << ");" << std::endl;
+        }
+        else
+        {
+            os << "        nnef_rt::block_copy<" << outer << ", " << size << ", " << size << ", " << total << ">("
+               << cpp_id(part.name) << ", " << cpp_id(whole.name) << " + " << offset << ");" << std::endl;
+        }
+        offset += size;
+    }
+    return true;
+}
+
+bool write_reduce( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, std::string& error )
+{
+    const auto& output = output_tensor(graph, operation);
+    const auto& input = *input_tensor(graph, operation, 0);
+    auto axes = int_list(operation.attribs.get("axes"));
+    if ( operation.name == "softmax" && !operation.attribs.get("axes").size() )
+    {
+        axes.push_back(1);
+    }
+    size_t outer, reduced, inner;
+    if ( !reduce_layout(input.shape, axes, outer, reduced, inner, error) )
+    {
+        error = operation.name + " producing '" + output.name + "': " + error;
+        return false;
+    }
+    if ( operation.name == "softmax" )
+    {
+        os << "        nnef_rt::softmax<" << outer << ", " << reduced << ", " << inner << ">(";
+    }
+    else
+    {
+        const char* reduction = operation.name == "max_reduce" ? "nnef_rt::red_max" : operation.name == "min_reduce" ? "nnef_rt::red_min" : "nnef_rt::red_sum";
+        os << "        nnef_rt::reduce<" << reduction << ", " << outer << ", " << reduced << ", " << inner << ", "
+           << (operation.name == "mean_reduce" ? "true" : "false") << ">(";
+    }
+    os << cpp_id(input.name) << ", " << cpp_id(output.name) << ");" << std::endl;
+    return true;
+}
+
+const std::set<std::string> elementwise =
+{
+    "copy", "neg", "rcp", "exp", "log", "log2", "sin", "cos", "tan", "tanh", "sigmoid", "softplus", "abs", "sign",
+    "not", "floor", "ceil", "round", "sqr", "sqrt", "rsqrt", "relu",
+    "add", "sub", "mul", "div", "pow", "min", "max", "lt", "gt", "le", "ge", "eq", "ne", "and", "or",
+    "select",
+};
+
+bool write_operation( std::ostream& os, const nnef::Graph& graph, const nnef::Operation& operation, literal_pool& literals, std::string& error )
+{
+    const auto& name = operation.name;
+    if ( elementwise.count(name) )
+    {
+        return write_elementwise(os, graph, operation, literals, error);
+    }
+    else if ( name == "conv" )
+    {
+        return write_conv(os, graph, operation, literals, error);
+    }
+    else if ( name == "max_pool" || name == "avg_pool" || name == "box" )
+    {
+        return write_pool(os, graph, operation, error);
+    }
+    else if ( name == "linear" )
+    {
+        return write_linear(os, graph, operation, literals, error);
+    }
+    else if ( name == "matmul" )
+    {
+        return write_matmul(os, graph, operation, error);
+    }
+    else if ( name == "reshape" || name == "squeeze" || name == "unsqueeze" )
+    {
+        const auto& output = output_tensor(graph, operation);
+        os << "        nnef_rt::unary<nnef_rt::op_copy, " << volume(output.shape) << ">("
+           << cpp_id(operation.inputs[0].second.identifier()) << ", " << cpp_id(output.name) << ");" << std::endl;
+        return true;
+    }
+    else if ( name == "transpose" )
+    {
+        return write_transpose(os, graph, operation, error);
+    }
+    else if ( name == "slice" )
+    {
+        return write_slice(os, graph, operation, error);
+    }
+    else if ( name == "concat" || name == "split" )
+    {
+        return write_concat(os, graph, operation, name == "split");
+    }
+    else if ( name == "sum_reduce" || name == "mean_reduce" || name == "max_reduce" || name == "min_reduce" || name == "softmax" )
+    {
+        return write_reduce(os, graph, operation, error);
+    }
+    error = "operation '" + name + "' is not supported by the C++ backend";
+    return false;
+}
+
+int main( int argc, const char * argv[] )
+{
+    if ( argc < 2 )
+    {
+        std::cerr << "Input file name must be provided" << std::endl;
+        return -1;
+    }
+
+    const std::string path = argv[1];
+    std::string stdlib;
+    std::string output_path;
+    size_t iterations = 100;
+
+    for ( int i = 2; i < argc; ++i )
+    {
+        const std::string arg = argv[i];
+        if ( arg == "--stdlib" )
+        {
+            if ( i+1 >= argc || *argv[i+1] == '-' )
+            {
+                std::cerr << "Stdlib file name must be provided after --stdlib; ignoring option" << std::endl;
+            }
+            else
+            {
+                try
+                {
+                    stdlib = read_file(argv[++i]);
+                }
+                catch ( const std::runtime_error& e )
+                {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+        else if ( arg == "--output" )
+        {
+            if ( i+1 >= argc || *argv[i+1] == '-' )
+            {
+                std::cerr << "Output file name must be provided after --output; ignoring option" << std::endl;
+            }
+            else
+            {
+                output_path = argv[++i];
+            }
+        }
+        else if ( arg == "--iterations" )
+        {
+            if ( i+1 >= argc || std::atoi(argv[i+1]) <= 0 )
+            {
+                std::cerr << "Positive iteration count must be provided after --iterations; ignoring option" << std::endl;
+            }
+            else
+            {
+                iterations = (size_t)std::atoi(argv[++i]);
+            }
+        }
+        else
+        {
+            std::cerr << "Unrecognized option: " << argv[i] << "; ignoring" << std::endl;
+        }
+    }
+
+    nnef::Graph graph;
+    std::string error;
+
+    if ( !nnef::load_graph(path, graph, error, stdlib, lowered) )
+    {
+        std::cerr << error << std::endl;
+        return -2;
+    }
+
+    if ( !nnef::infer_shapes(graph, error) )
+    {
+        std::cerr << error << std::endl;
+        return -3;
+    }
+
+    const std::unordered_set<std::string> graph_outputs(graph.outputs.begin(), graph.outputs.end());
+
+    // Forward is generated first, so unsupported operations are reported before any output
+    std::ostringstream forward;
+    literal_pool literals;
+    std::vector<std::string> intermediates;
+    for ( const auto& operation : graph.operations )
+    {
+        if ( operation.name == "external" || operation.name == "variable" || operation.name == "constant" )
+        {
+            continue;
+        }
+        if ( !write_operation(forward, graph, operation, literals, error) )
+        {
+            std::cerr << error << std::endl;
+            return -4;
+        }
+        std::vector<std::string> ids;
+        for ( const auto& output : operation.outputs )
+        {
+            collect_identifiers(output.second, ids);
+        }
+        for ( const auto& id : ids )
+        {
+            if ( !graph_outputs.count(id) )
+            {
+                intermediates.push_back(id);
+            }
+        }
+    }
+
+    std::vector<size_t> sizes;
+    for ( const auto& id : intermediates )
+    {
+        sizes.push_back(tensor_bytes(graph.tensors.at(id)));
+    }
+    const storage_plan plan = plan_storage(graph, intermediates, sizes);
+    std::cerr << "Planned storage: " << plan.size << " bytes for " << intermediates.size() << " intermediate tensors ("
+              << plan.unshared_size << " bytes without reuse)" << std::endl;
+
+    std::ofstream file;
+    if ( !output_path.empty() )
+    {
+        file.open(output_path, std::ios::binary);
+        if ( !file )
+        {
+            std::cerr << "Could not open output file: " << output_path << std::endl;
+            return -5;
+        }
+    }
+    std::ostream& os = output_path.empty() ? std::cout : file;
+
+    os << "// " << graph.name << ".cpp" << std::endl;
+    os << "// Build: c++ -std=c++11 -O3 -march=native " << graph.name << ".cpp -o " << graph.name << std::endl;
+    os << "#include <algorithm>" << std::endl;
+    os << "#include <chrono>" << std::endl;
+    os << "#include <cmath>" << std::endl;
+    os << "#include <cstddef>" << std::endl;
+    os << "#include <cstdio>" << std::endl;
+    os << "#include <cstdlib>" << std::endl;
+    os << "#include <cstring>" << std::endl;
+    os << "#include <limits>" << std::endl;
+    os << "#include <string>" << std::endl;
+    os << "#include <vector>" << std::endl;
+    os << runtime_kernels << runtime_io << std::endl;
+
+    os << "namespace " << graph.name << std::endl;
+    os << "{" << std::endl;
+    for ( const auto& id : graph.inputs )
+    {
+        const auto& tensor = graph.tensors.at(id);
+        os << "    alignas(" << arena_alignment << ") " << cpp_type(tensor.dtype) << " " << cpp_id(id) << "[" << std::max<size_t>(volume(tensor.shape), 1) << "];" << std::endl;
+    }
+    for ( const auto& id : graph.outputs )
+    {
+        const auto& tensor = graph.tensors.at(id);
+        os << "    alignas(" << arena_alignment << ") " << cpp_type(tensor.dtype) << " " << cpp_id(id) << "[" << std::max<size_t>(volume(tensor.shape), 1) << "];" << std::endl;
+    }
+    for ( const auto& operation : graph.operations )
+    {
+        if ( operation.name != "variable" && operation.name != "constant" )
+        {
+            continue;
+        }
+        const auto& tensor = output_tensor(graph, operation);
+        const size_t count = volume(tensor.shape);
+        if ( operation.name == "variable" )
+        {
+            if ( tensor.data.size() != element_size(tensor.dtype) * count )
+            {
+                std::cerr << "data of variable '" << tensor.name << "' is not loaded; the model must be a folder with binary data" << std::endl;
+                return -4;
+            }
+            write_array(os, "static const ", tensor.dtype, cpp_id(tensor.name), count, [&]( size_t i ){ return data_item(tensor, i); });
+        }
+        else
+        {
+            const auto& value = operation.attribs.get("value");
+            write_array(os, "static const ", tensor.dtype, cpp_id(tensor.name), count,
+                        [&]( size_t i ){ return value_item(value[value.size() == 1 ? 0 : i]); });
+        }
+    }
+    os << literals.declarations.str();
+    // Intermediates that share no storage are arrays of their own type; those that do are members of
+    // a union over their storage, so that no pointer casts hide from the compiler which ones may alias
+    os << "    // Storage of " << plan.size << " bytes for " << intermediates.size() << " intermediate tensors ("
+       << plan.unshared_size << " bytes without reuse)" << std::endl;
+    std::vector<std::string> placed(intermediates);
+    std::stable_sort(placed.begin(), placed.end(), [&plan]( const std::string& a, const std::string& b ){ return plan.offsets.at(a) < plan.offsets.at(b); });
+    size_t unions = 0;
+    for ( size_t k = 0; k < placed.size(); )
+    {
+        const size_t begin = plan.offsets.at(placed[k]);
+        size_t end = begin + tensor_bytes(graph.tensors.at(placed[k]));
+        size_t next = k + 1;
+        for ( ; next < placed.size() && plan.offsets.at(placed[next]) < end; ++next )
+        {
+            end = std::max(end, plan.offsets.at(placed[next]) + tensor_bytes(graph.tensors.at(placed[next])));
+        }
+        if ( next == k + 1 )
+        {
+            const auto& tensor = graph.tensors.at(placed[k]);
+            os << "    alignas(" << arena_alignment << ") static " << cpp_type(tensor.dtype) << " " << cpp_id(placed[k])
+               << "[" << std::max<size_t>(volume(tensor.shape), 1) << "];    // " << shape_list(tensor.shape) << std::endl;
+            k = next;
+            continue;
+        }
+
+        const std::string name = "shared_" + std::to_string(++unions);
+        os << "    static union alignas(" << arena_alignment << ")" << std::endl;
+        os << "    {" << std::endl;
+        for ( size_t i = k; i < next; ++i )
+        {
+            const auto& tensor = graph.tensors.at(placed[i]);
+            const size_t offset = plan.offsets.at(placed[i]) - begin;
+            const std::string items = cpp_type(tensor.dtype) + " " + (offset ? "items" : cpp_id(placed[i])) +
+                                      "[" + std::to_string(std::max<size_t>(volume(tensor.shape), 1)) + "];";
+            if ( offset )
+            {
+                os << "        struct { unsigned char pad[" << offset << "]; " << items << " } " << cpp_id(placed[i]) << ";" << std::endl;
+            }
+            else
+            {
+                os << "        " << items << std::endl;
+            }
+        }
+        os << "    } " << name << ";" << std::endl;
+        for ( size_t i = k; i < next; ++i )
+        {
+            const auto& tensor = graph.tensors.at(placed[i]);
+            const size_t offset = plan.offsets.at(placed[i]) - begin;
+            os << "    static " << cpp_type(tensor.dtype) << " (&" << cpp_id(placed[i]) << ")[" << std::max<size_t>(volume(tensor.shape), 1) << "] = "
+               << name << "." << cpp_id(placed[i]) << (offset ? ".items" : "") << ";    // " << shape_list(tensor.shape) << std::endl;
+        }
+        k = next;
+    }
+    os << std::endl;
+    os << "    void forward()" << std::endl;
+    os << "    {" << std::endl;
+    os << forward.str();
+    os << "    }" << std::endl;
+    os << "}" << std::endl;
+    os << std::endl;
+
+    os << "int main( int argc, char* argv[] )" << std::endl;
+    os << "{" << std::endl;
+    os << "    size_t iterations = " << iterations << ";" << std::endl;
+    os << "    std::vector<const char*> inputs, outputs;" << std::endl;
+    os << "    for ( int i = 1; i < argc; ++i )" << std::endl;
+    os << "    {" << std::endl;
+    os << "        const std::string arg = argv[i];" << std::endl;
+    os << "        if ( arg == \"--iterations\" && i + 1 < argc )" << std::endl;
+    os << "        {" << std::endl;
+    os << "            iterations = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);" << std::endl;
+    os << "        }" << std::endl;
+    os << "        else if ( arg == \"--input\" || arg == \"--output\" )" << std::endl;
+    os << "        {" << std::endl;
+    os << "            while ( i + 1 < argc && *argv[i + 1] != '-' )" << std::endl;
+    os << "            {" << std::endl;
+    os << "                (arg == \"--input\" ? inputs : outputs).push_back(argv[++i]);" << std::endl;
+    os << "            }" << std::endl;
+    os << "        }" << std::endl;
+    os << "        else" << std::endl;
+    os << "        {" << std::endl;
+    os << "            std::fprintf(stderr, \"Unrecognized option: %s; ignoring\\n\", argv[i]);" << std::endl;
+    os << "        }" << std::endl;
+    os << "    }" << std::endl;
+    os << "    if ( (!inputs.empty() && inputs.size() != " << graph.inputs.size() << ") || (!outputs.empty() && outputs.size() != " << graph.outputs.size() << ") )" << std::endl;
+    os << "    {" << std::endl;
+    os << "        std::fprintf(stderr, \"Expected " << graph.inputs.size() << " input and " << graph.outputs.size() << " output file names\\n\");" << std::endl;
+    os << "        return -1;" << std::endl;
+    os << "    }" << std::endl;
+    for ( size_t i = 0; i < graph.inputs.size(); ++i )
+    {
+        const auto& tensor = graph.tensors.at(graph.inputs[i]);
+        os << "    static const unsigned shape_" << cpp_id(tensor.name) << "[] = { " << shape_list(tensor.shape) << (tensor.shape.empty() ? "0" : "") << " };" << std::endl;
+        os << "    if ( !inputs.empty() && !nnef_rt::read_tensor(inputs[" << i << "], " << graph.name << "::" << cpp_id(tensor.name)
+           << ", shape_" << cpp_id(tensor.name) << ", " << tensor.shape.size() << ") )" << std::endl;
+        os << "    {" << std::endl;
+        os << "        std::fprintf(stderr, \"Could not read tensor '" << tensor.name << "' of shape [" << shape_list(tensor.shape) << "] from %s\\n\", inputs[" << i << "]);" << std::endl;
+        os << "        return -1;" << std::endl;
+        os << "    }" << std::endl;
+    }
+    os << std::endl;
+    os << "    " << graph.name << "::forward();" << std::endl;
+    os << "    std::vector<double> times(iterations);" << std::endl;
+    os << "    for ( size_t i = 0; i < iterations; ++i )" << std::endl;
+    os << "    {" << std::endl;
+    os << "        const auto start = std::chrono::steady_clock::now();" << std::endl;
+    os << "        " << graph.name << "::forward();" << std::endl;
+    os << "        times[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();" << std::endl;
+    os << "    }" << std::endl;
+    os << "    double total = 0;" << std::endl;
+    os << "    for ( const auto& time : times )" << std::endl;
+    os << "    {" << std::endl;
+    os << "        total += time;" << std::endl;
+    os << "    }" << std::endl;
+    os << "    std::sort(times.begin(), times.end());" << std::endl;
+    os << "    std::fprintf(stderr, \"" << graph.name << ": %zu iterations, mean %.3f ms, median %.3f ms, min %.3f ms\\n\"," << std::endl;
+    os << "                 iterations, total / iterations, times[iterations / 2], times[0]);" << std::endl;
+    os << std::endl;
+    for ( size_t i = 0; i < graph.outputs.size(); ++i )
+    {
+        const auto& tensor = graph.tensors.at(graph.outputs[i]);
+        os << "    static const unsigned shape_" << cpp_id(tensor.name) << "[] = { " << shape_list(tensor.shape) << (tensor.shape.empty() ? "0" : "") << " };" << std::endl;
+        os << "    if ( !outputs.empty() && !nnef_rt::write_tensor(outputs[" << i << "], " << graph.name << "::" << cpp_id(tensor.name)
+           << ", shape_" << cpp_id(tensor.name) << ", " << tensor.shape.size() << ") )" << std::endl;
+        os << "    {" << std::endl;
+        os << "        std::fprintf(stderr, \"Could not write tensor '" << tensor.name << "' to %s\\n\", outputs[" << i << "]);" << std::endl;
+        os << "        return -1;" << std::endl;
+        os << "    }" << std::endl;
+    }
+    os << "    return 0;" << std::endl;
+    os << "}" << std::endl;
+
+    return 0;
+}
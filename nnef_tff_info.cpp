@@ -1,136 +1,2276 @@
 #include "nnef.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <iostream>
+#include <fstream>
 #include <numeric>
+#include <bitset>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <io.h>
+#include <fcntl.h>
+#define NOMINMAX
+#include <windows.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <dirent.h>
 #endif
 
+std::string shape_string( const std::vector<int>& shape )
+{
+    std::string str = "[";
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        if ( i )
+        {
+            str += ",";
+        }
+        str += std::to_string(shape[i]);
+    }
+    return str + "]";
+}
+
+template <typename T>
+T sqr( const T x )
+{
+    return x * x;
+}
+
+// Neumaier compensated summation, used to combine partial sums of blocks and threads
+struct compensated_sum
+{
+    double sum = 0;
+    double error = 0;
+
+    void add( const double x )
+    {
+        const double t = sum + x;
+        error += std::abs(sum) >= std::abs(x) ? (sum - t) + x : (x - t) + sum;
+        sum = t;
+    }
+
+    void add( const compensated_sum& other )
+    {
+        add(other.sum);
+        add(other.error);
+    }
+
+    double value() const
+    {
+        return sum + error;
+    }
+};
+
+struct difference_sums
+{
+    compensated_sum diff;
+    compensated_sum range;
+
+    void add( const difference_sums& other )
+    {
+        diff.add(other.diff);
+        range.add(other.range);
+    }
+};
+
+// Independent accumulator lanes let the compiler vectorize the inner loop without reassociating
+// floating point sums; blocks keep the plain double lanes short before compensated accumulation
+const size_t difference_lanes = 8;
+const size_t difference_block = 4096;
+
+template <typename T>
+difference_sums relative_data_difference( const size_t n, const T* data1, const T* data2 )
+{
+    difference_sums sums;
+    for ( size_t block = 0; block < n; block += difference_block )
+    {
+        const size_t end = std::min(n, block + difference_block);
+        double diff[difference_lanes] = {0};
+        double range[difference_lanes] = {0};
+        size_t i = block;
+        for ( ; i + difference_lanes <= end; i += difference_lanes )
+        {
+            for ( size_t k = 0; k < difference_lanes; ++k )
+            {
+                const double x = data1[i+k];
+                const double y = data2[i+k];
+                diff[k] += sqr(y - x);
+                range[k] += sqr(x);
+            }
+        }
+        for ( size_t k = 0; i < end; ++i, ++k )
+        {
+            const double x = data1[i];
+            const double y = data2[i];
+            diff[k] += sqr(y - x);
+            range[k] += sqr(x);
+        }
+        for ( size_t k = 0; k < difference_lanes; ++k )
+        {
+            sums.diff.add(diff[k]);
+            sums.range.add(range[k]);
+        }
+    }
+    return sums;
+}
+
+// Below this number of elements per thread it is not worth to start one
+const size_t min_elements_per_thread = 1 << 18;
+
+// Number of threads to split n elements over, at most max_threads
+size_t thread_count( const size_t n, const size_t max_threads )
+{
+    size_t count = std::min<size_t>(max_threads, n / min_elements_per_thread);
+    return std::max<size_t>(count, 1);
+}
+
+template <typename T>
+difference_sums parallel_relative_data_difference( const size_t n, const T* data1, const T* data2, const size_t max_threads )
+{
+    const size_t count = thread_count(n, max_threads);
+    if ( count == 1 )
+    {
+        return relative_data_difference(n, data1, data2);
+    }
+
+    std::vector<difference_sums> partial(count);
+    std::vector<std::thread> threads;
+    const size_t chunk = (n + count - 1) / count;
+    for ( size_t t = 0; t < count; ++t )
+    {
+        const size_t begin = std::min(n, t * chunk);
+        const size_t end = std::min(n, begin + chunk);
+        threads.emplace_back([&partial, t, begin, end, data1, data2]()
+        {
+            partial[t] = relative_data_difference(end - begin, data1 + begin, data2 + begin);
+        });
+    }
+
+    difference_sums sums;
+    for ( size_t t = 0; t < count; ++t )
+    {
+        threads[t].join();
+        sums.add(partial[t]);
+    }
+    return sums;
+}
+
+double relative_difference( const difference_sums& sums )
+{
+    const double diff = sums.diff.value();
+    const double range = sums.range.value();
+    if ( range == 0 )
+    {
+        return diff == 0 ? 0 : std::numeric_limits<double>::infinity();
+    }
+    return std::sqrt(diff / range);
+}
+
+// Element layout for per-axis error breakdown; inner is the number of items following
+// one index of the axis, zero if no axis is selected
+struct metrics_layout
+{
+    uint64_t inner = 0;
+    size_t extent = 1;
+    size_t worst_count = 0;
+};
+
+struct channel_error
+{
+    difference_sums sums;
+    double max_abs_error = 0;
+};
+
+struct element_error
+{
+    uint64_t index;
+    double abs_error;
+    double value1;
+    double value2;
+
+    bool operator<( const element_error& other ) const
+    {
+        return abs_error > other.abs_error;
+    }
+};
+
+struct error_metrics
+{
+    difference_sums sums;
+    compensated_sum norm1;    // of finite pairs only, like dot and norm2
+    compensated_sum dot;
+    compensated_sum norm2;
+    compensated_sum ulp_sum;
+    uint64_t count = 0;
+    uint64_t finite_count = 0;
+    uint64_t nan_mismatches = 0;
+    uint64_t inf_mismatches = 0;
+    double max_abs_error = 0;
+    uint64_t max_abs_index = 0;
+    double max_rel_error = 0;
+    uint64_t max_rel_index = 0;
+    uint64_t max_ulp = 0;
+    uint64_t max_ulp_index = 0;
+    std::vector<channel_error> channels;
+    std::vector<element_error> worst;    // min-heap on absolute error, of at most worst_count items
+
+    explicit error_metrics( const metrics_layout& layout )
+    : channels(layout.inner ? layout.extent : 0)
+    {
+    }
+
+    void add_worst( const element_error& item, const size_t worst_count )
+    {
+        if ( worst.size() < worst_count )
+        {
+            worst.push_back(item);
+            std::push_heap(worst.begin(), worst.end());
+        }
+        else if ( worst_count && item.abs_error > worst.front().abs_error )
+        {
+            std::pop_heap(worst.begin(), worst.end());
+            worst.back() = item;
+            std::push_heap(worst.begin(), worst.end());
+        }
+    }
+
+    void add( const error_metrics& other, const size_t worst_count )
+    {
+        sums.add(other.sums);
+        norm1.add(other.norm1);
+        dot.add(other.dot);
+        norm2.add(other.norm2);
+        ulp_sum.add(other.ulp_sum);
+        count += other.count;
+        finite_count += other.finite_count;
+        nan_mismatches += other.nan_mismatches;
+        inf_mismatches += other.inf_mismatches;
+        if ( other.max_abs_error > max_abs_error )
+        {
+            max_abs_error = other.max_abs_error;
+            max_abs_index = other.max_abs_index;
+        }
+        if ( other.max_rel_error > max_rel_error )
+        {
+            max_rel_error = other.max_rel_error;
+            max_rel_index = other.max_rel_index;
+        }
+        if ( other.max_ulp > max_ulp )
+        {
+            max_ulp = other.max_ulp;
+            max_ulp_index = other.max_ulp_index;
+        }
+        for ( size_t i = 0; i < channels.size(); ++i )
+        {
+            channels[i].sums.add(other.channels[i].sums);
+            channels[i].max_abs_error = std::max(channels[i].max_abs_error, other.channels[i].max_abs_error);
+        }
+        for ( const auto& item : other.worst )
+        {
+            add_worst(item, worst_count);
+        }
+    }
+
+    double cosine_similarity() const
+    {
+        const double norm = std::sqrt(norm1.value() * norm2.value());
+        if ( norm == 0 )
+        {
+            return norm1.value() == norm2.value() ? 1 : 0;
+        }
+        return dot.value() / norm;
+    }
+
+    double mean_ulp() const
+    {
+        return finite_count ? ulp_sum.value() / finite_count : 0;
+    }
+
+    uint64_t non_finite_count() const
+    {
+        return count - finite_count;
+    }
+};
+
+// Distance in units in the last place; floating point bit patterns are mapped to
+// monotonically ordered integers so that the distance crosses zero correctly
+int64_t ordered_bits( const float value )
+{
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? (int64_t)std::numeric_limits<int32_t>::min() - bits : bits;
+}
+
+int64_t ordered_bits( const double value )
+{
+    int64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? std::numeric_limits<int64_t>::min() - bits : bits;
+}
+
+uint64_t ulp_distance( const float x, const float y )
+{
+    const int64_t a = ordered_bits(x);
+    const int64_t b = ordered_bits(y);
+    return a > b ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a;
+}
+
+uint64_t ulp_distance( const double x, const double y )
+{
+    const int64_t a = ordered_bits(x);
+    const int64_t b = ordered_bits(y);
+    return a > b ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a;
+}
+
+template <typename T>
+uint64_t ulp_distance( const T x, const T y )
+{
+    return x > y ? (uint64_t)x - (uint64_t)y : (uint64_t)y - (uint64_t)x;
+}
+
+// Computes all metrics in one pass over memory; each block is first reduced into vectorizable
+// sum lanes and then scanned for extrema while it is still in cache. Pairs with a NaN or Inf
+// item enter the relative difference sums as in relative_data_difference, so that they show
+// in the result; the other metrics are computed over finite pairs only. Per-channel sums are
+// gathered in the scan over runs of items of the same channel, which end at channel and block
+// boundaries, so blocks keep their full length even if the channel changes with every item
+template <typename T>
+void error_metrics_kernel( const size_t n, const uint64_t base, const T* data1, const T* data2,
+                           const metrics_layout& layout, error_metrics& metrics )
+{
+    uint64_t position = layout.inner ? base % layout.inner : 0;    // items of the current run so far
+    size_t channel = layout.inner ? (size_t)(base / layout.inner % layout.extent) : 0;
+    double run_diff = 0;
+    double run_range = 0;
+    double run_max_abs_error = 0;
+    auto end_run = [&]()
+    {
+        channel_error& error = metrics.channels[channel];
+        error.sums.diff.add(run_diff);
+        error.sums.range.add(run_range);
+        error.max_abs_error = std::max(error.max_abs_error, run_max_abs_error);
+        run_diff = run_range = run_max_abs_error = 0;
+    };
+
+    for ( size_t block = 0; block < n; block += difference_block )
+    {
+        const size_t end = std::min(n, block + difference_block);
+        double diff[difference_lanes] = {0};
+        double range[difference_lanes] = {0};
+        double norm1[difference_lanes] = {0};
+        double dot[difference_lanes] = {0};
+        double norm2[difference_lanes] = {0};
+        size_t i = block;
+        for ( ; i < end; i += difference_lanes )
+        {
+            const size_t lanes = std::min(difference_lanes, end - i);
+            for ( size_t k = 0; k < lanes; ++k )
+            {
+                const double x = data1[i+k];
+                const double y = data2[i+k];
+                const bool finite = std::isfinite(x) && std::isfinite(y);
+                diff[k] += sqr(y - x);
+                range[k] += sqr(x);
+                norm1[k] += finite ? sqr(x) : 0.0;
+                dot[k] += finite ? x * y : 0.0;
+                norm2[k] += finite ? sqr(y) : 0.0;
+            }
+        }
+
+        difference_sums block_sums;
+        for ( size_t k = 0; k < difference_lanes; ++k )
+        {
+            block_sums.diff.add(diff[k]);
+            block_sums.range.add(range[k]);
+            metrics.norm1.add(norm1[k]);
+            metrics.dot.add(dot[k]);
+            metrics.norm2.add(norm2[k]);
+        }
+        metrics.sums.add(block_sums);
+
+        double ulp_sum = 0;
+        for ( i = block; i < end; ++i )
+        {
+            const double x = data1[i];
+            const double y = data2[i];
+            if ( layout.inner )
+            {
+                if ( position == layout.inner )
+                {
+                    end_run();
+                    position = 0;
+                    channel = channel + 1 == layout.extent ? 0 : channel + 1;
+                }
+                ++position;
+                run_diff += sqr(y - x);
+                run_range += sqr(x);
+            }
+            if ( !std::isfinite(x) || !std::isfinite(y) )
+            {
+                if ( std::isnan(x) != std::isnan(y) )
+                {
+                    ++metrics.nan_mismatches;
+                }
+                else if ( !std::isnan(x) && x != y )
+                {
+                    ++metrics.inf_mismatches;
+                }
+                continue;
+            }
+            ++metrics.finite_count;
+
+            const double abs_error = std::abs(y - x);
+            if ( abs_error > metrics.max_abs_error )
+            {
+                metrics.max_abs_error = abs_error;
+                metrics.max_abs_index = base + i;
+            }
+            run_max_abs_error = std::max(run_max_abs_error, abs_error);
+            if ( x != 0 && abs_error / std::abs(x) > metrics.max_rel_error )
+            {
+                metrics.max_rel_error = abs_error / std::abs(x);
+                metrics.max_rel_index = base + i;
+            }
+
+            const uint64_t ulp = ulp_distance(data1[i], data2[i]);
+            if ( ulp > metrics.max_ulp )
+            {
+                metrics.max_ulp = ulp;
+                metrics.max_ulp_index = base + i;
+            }
+            ulp_sum += (double)ulp;
+
+            if ( layout.worst_count && (metrics.worst.size() < layout.worst_count || abs_error > metrics.worst.front().abs_error) )
+            {
+                element_error item = { base + i, abs_error, x, y };
+                metrics.add_worst(item, layout.worst_count);
+            }
+        }
+        metrics.ulp_sum.add(ulp_sum);
+        metrics.count += end - block;
+        if ( layout.inner )
+        {
+            end_run();
+        }
+    }
+}
+
+template <typename T>
+void parallel_error_metrics( const size_t n, const uint64_t base, const T* data1, const T* data2,
+                             const metrics_layout& layout, const size_t max_threads, error_metrics& metrics )
+{
+    const size_t count = thread_count(n, max_threads);
+    if ( count == 1 )
+    {
+        error_metrics partial(layout);
+        error_metrics_kernel(n, base, data1, data2, layout, partial);
+        metrics.add(partial, layout.worst_count);
+        return;
+    }
+
+    std::vector<error_metrics> partial(count, error_metrics(layout));
+    std::vector<std::thread> threads;
+    const size_t chunk = (n + count - 1) / count;
+    for ( size_t t = 0; t < count; ++t )
+    {
+        const size_t begin = std::min(n, t * chunk);
+        const size_t end = std::min(n, begin + chunk);
+        threads.emplace_back([&partial, &layout, t, begin, end, base, data1, data2]()
+        {
+            error_metrics_kernel(end - begin, base + begin, data1 + begin, data2 + begin, layout, partial[t]);
+        });
+    }
+
+    for ( size_t t = 0; t < count; ++t )
+    {
+        threads[t].join();
+        metrics.add(partial[t], layout.worst_count);
+    }
+}
+
+bool make_metrics_layout( const std::vector<int>& shape, const int axis, const size_t worst_count,
+                          metrics_layout& layout, std::string& error )
+{
+    layout.worst_count = worst_count;
+    if ( axis < 0 )
+    {
+        return true;
+    }
+    if ( axis >= (int)shape.size() )
+    {
+        error = "axis " + std::to_string(axis) + " out of range for shape " + shape_string(shape);
+        return false;
+    }
+    layout.extent = shape[axis];
+    layout.inner = std::accumulate(shape.begin() + axis + 1, shape.end(), (uint64_t)1, std::multiplies<uint64_t>());
+    return true;
+}
+
+size_t volume(const nnef::Tensor& tensor)
+{
+    const std::vector<int>& shape = tensor.shape;
+    return std::accumulate(shape.begin(), shape.end(), (size_t)1, std::multiplies<size_t>());
+}
+
+bool check_compatible( const nnef::Tensor& tensor1, const nnef::Tensor& tensor2, std::string& error )
+{
+    if ( tensor1.dtype != tensor2.dtype )
+    {
+        error = "data type mismatch: " + tensor1.dtype + " vs " + tensor2.dtype;
+        return false;
+    }
+    if ( tensor1.shape != tensor2.shape )
+    {
+        error = "shape mismatch: " + shape_string(tensor1.shape) + " vs " + shape_string(tensor2.shape);
+        return false;
+    }
+    if ( tensor1.dtype != "scalar" && tensor1.dtype != "integer" && tensor1.dtype != "logical" )
+    {
+        error = "unsupported data type: " + tensor1.dtype;
+        return false;
+    }
+    return true;
+}
+
+bool relative_difference( const nnef::Tensor& tensor1, const nnef::Tensor& tensor2, const size_t threads,
+                          double& result, std::string& error )
+{
+    if ( !check_compatible(tensor1, tensor2, error) )
+    {
+        return false;
+    }
+
+    const size_t n = volume(tensor1);
+    if ( tensor1.dtype == "scalar" )
+    {
+        result = relative_difference(parallel_relative_data_difference(n,
+            (const float*)tensor1.data.data(), (const float*)tensor2.data.data(), threads));
+    }
+    else if ( tensor1.dtype == "integer" )
+    {
+        result = relative_difference(parallel_relative_data_difference(n,
+            (const int*)tensor1.data.data(), (const int*)tensor2.data.data(), threads));
+    }
+    else
+    {
+        result = relative_difference(parallel_relative_data_difference(n,
+            (const bool*)tensor1.data.data(), (const bool*)tensor2.data.data(), threads));
+    }
+    return true;
+}
+
+bool error_metrics_difference( const nnef::Tensor& tensor1, const nnef::Tensor& tensor2, const metrics_layout& layout,
+                               const size_t threads, error_metrics& metrics, std::string& error )
+{
+    if ( !check_compatible(tensor1, tensor2, error) )
+    {
+        return false;
+    }
+
+    const size_t n = volume(tensor1);
+    if ( tensor1.dtype == "scalar" )
+    {
+        parallel_error_metrics(n, 0, (const float*)tensor1.data.data(), (const float*)tensor2.data.data(), layout, threads, metrics);
+    }
+    else if ( tensor1.dtype == "integer" )
+    {
+        parallel_error_metrics(n, 0, (const int*)tensor1.data.data(), (const int*)tensor2.data.data(), layout, threads, metrics);
+    }
+    else
+    {
+        parallel_error_metrics(n, 0, (const bool*)tensor1.data.data(), (const bool*)tensor2.data.data(), layout, threads, metrics);
+    }
+    return true;
+}
+
+// Layout of the NNEF binary tensor file header
+const size_t tensor_header_size = 128;
+const size_t max_tensor_rank = 8;
+
+enum tensor_item_type
+{
+    item_float = 0x00,
+    item_uint = 0x01,
+    item_quint = 0x02,
+    item_qint = 0x03,
+    item_int = 0x04,
+    item_bool = 0x05,
+};
+
+struct tensor_file_header
+{
+    std::vector<int> shape;
+    uint32_t data_length;
+    uint32_t bits_per_item;
+    uint32_t item_type;
+};
+
+uint32_t read_uint32( const unsigned char* bytes )
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+std::string tensor_dtype( const tensor_file_header& header )
+{
+    switch ( header.item_type )
+    {
+        case item_float:
+            return "scalar";
+        case item_bool:
+            return "logical";
+        default:
+            return "integer";
+    }
+}
+
+bool read_tensor_header( const std::string& path, tensor_file_header& header, std::string& error )
+{
+    std::ifstream is(path, std::ios::binary);
+    unsigned char bytes[tensor_header_size];
+    if ( !is || !is.read((char*)bytes, tensor_header_size) )
+    {
+        error = "could not read tensor header: " + path;
+        return false;
+    }
+    if ( bytes[0] != 0x4E || bytes[1] != 0xEF )
+    {
+        error = "invalid magic number in tensor file: " + path;
+        return false;
+    }
+
+    header.data_length = read_uint32(bytes + 4);
+    const uint32_t rank = read_uint32(bytes + 8);
+    if ( rank > max_tensor_rank )
+    {
+        error = "tensor rank " + std::to_string(rank) + " exceeds maximum in file: " + path;
+        return false;
+    }
+    header.shape.resize(rank);
+    for ( size_t i = 0; i < rank; ++i )
+    {
+        header.shape[i] = (int)read_uint32(bytes + 12 + 4 * i);
+    }
+    header.bits_per_item = read_uint32(bytes + 44);
+    header.item_type = read_uint32(bytes + 48);
+
+    const uint64_t count = std::accumulate(header.shape.begin(), header.shape.end(), (uint64_t)1, std::multiplies<uint64_t>());
+    if ( header.data_length != (count * header.bits_per_item + 7) / 8 )
+    {
+        error = "data length does not match tensor shape in file: " + path;
+        return false;
+    }
+    return true;
+}
+
+// Read-only memory mapping of a window of a file; only one window is mapped at a time
+class mapped_file
+{
+public:
+
+    mapped_file() = default;
+    mapped_file( const mapped_file& ) = delete;
+    mapped_file& operator=( const mapped_file& ) = delete;
+
+    ~mapped_file()
+    {
+        unmap();
+#ifdef _WIN32
+        if ( _mapping )
+        {
+            CloseHandle(_mapping);
+        }
+        if ( _file != INVALID_HANDLE_VALUE )
+        {
+            CloseHandle(_file);
+        }
+#else
+        if ( _file != -1 )
+        {
+            close(_file);
+        }
+#endif
+    }
+
+    bool open( const std::string& path, std::string& error )
+    {
+#ifdef _WIN32
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if ( _file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size) )
+        {
+            error = "could not open file: " + path;
+            return false;
+        }
+        _size = (uint64_t)size.QuadPart;
+        _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if ( !_mapping )
+        {
+            error = "could not map file: " + path;
+            return false;
+        }
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        _granularity = info.dwAllocationGranularity;
+#else
+        _file = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if ( _file == -1 || fstat(_file, &st) != 0 )
+        {
+            error = "could not open file: " + path;
+            return false;
+        }
+        _size = (uint64_t)st.st_size;
+        _granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+        _path = path;
+        return true;
+    }
+
+    bool map( const uint64_t offset, const size_t length, std::string& error )
+    {
+        unmap();
+        if ( offset + length > _size )
+        {
+            error = "unexpected end of file: " + _path;
+            return false;
+        }
+        const uint64_t aligned = offset - offset % _granularity;
+        _view_length = (size_t)(offset - aligned) + length;
+#ifdef _WIN32
+        _view = MapViewOfFile(_mapping, FILE_MAP_READ, (DWORD)(aligned >> 32), (DWORD)aligned, _view_length);
+        if ( !_view )
+#else
+        _view = mmap(nullptr, _view_length, PROT_READ, MAP_PRIVATE, _file, (off_t)aligned);
+        if ( _view == MAP_FAILED )
+#endif
+        {
+            _view = nullptr;
+            error = "could not map file: " + _path;
+            return false;
+        }
+#ifndef _WIN32
+        madvise(_view, _view_length, MADV_SEQUENTIAL);
+#endif
+        _data = (const char*)_view + (offset - aligned);
+        return true;
+    }
+
+    const char* data() const
+    {
+        return _data;
+    }
+
+    uint64_t size() const
+    {
+        return _size;
+    }
+
+private:
+
+    void unmap()
+    {
+        if ( _view )
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(_view);
+#else
+            munmap(_view, _view_length);
+#endif
+            _view = nullptr;
+        }
+    }
+
+private:
+
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = NULL;
+#else
+    int _file = -1;
+#endif
+    std::string _path;
+    uint64_t _size = 0;
+    uint64_t _granularity = 1;
+    void* _view = nullptr;
+    size_t _view_length = 0;
+    const char* _data = nullptr;
+};
+
+typedef difference_sums (*difference_kernel)( const size_t n, const void* data1, const void* data2, const size_t threads );
+typedef void (*metrics_kernel)( const size_t n, const uint64_t base, const void* data1, const void* data2,
+                                const metrics_layout& layout, const size_t threads, error_metrics& metrics );
+
+struct comparison_kernels
+{
+    difference_kernel difference;
+    metrics_kernel metrics;
+};
+
+template <typename T>
+difference_sums typed_data_difference( const size_t n, const void* data1, const void* data2, const size_t threads )
+{
+    return parallel_relative_data_difference(n, (const T*)data1, (const T*)data2, threads);
+}
+
+template <typename T>
+void typed_error_metrics( const size_t n, const uint64_t base, const void* data1, const void* data2,
+                          const metrics_layout& layout, const size_t threads, error_metrics& metrics )
+{
+    parallel_error_metrics(n, base, (const T*)data1, (const T*)data2, layout, threads, metrics);
+}
+
+template <typename T>
+comparison_kernels typed_kernels()
+{
+    comparison_kernels kernels = { typed_data_difference<T>, typed_error_metrics<T> };
+    return kernels;
+}
+
+// Logical tensors are stored with 1 bit per item, most significant bit first
+difference_sums packed_bits_difference( const size_t n, const void* data1, const void* data2, const size_t )
+{
+    const unsigned char* bytes1 = (const unsigned char*)data1;
+    const unsigned char* bytes2 = (const unsigned char*)data2;
+    const size_t count = (n + 7) / 8;
+    uint64_t diff = 0;
+    uint64_t range = 0;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const unsigned mask = i + 1 < count || n % 8 == 0 ? 0xFF : (0xFF00 >> (n % 8)) & 0xFF;
+        diff += std::bitset<8>((bytes1[i] ^ bytes2[i]) & mask).count();
+        range += std::bitset<8>(bytes1[i] & mask).count();
+    }
+    difference_sums sums;
+    sums.diff.add((double)diff);
+    sums.range.add((double)range);
+    return sums;
+}
+
+void unpack_bits( const size_t n, const void* data, std::vector<uint8_t>& items )
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    items.resize(n);
+    for ( size_t i = 0; i < n; ++i )
+    {
+        items[i] = (bytes[i / 8] >> (7 - i % 8)) & 1;
+    }
+}
+
+// Items unpacked at a time for the metrics of logical tensors; a multiple of 8 that bounds the
+// memory of the unpacked copies, which take a byte per item, independently of the data size
+const size_t unpack_block_items = 1 << 24;
+
+void packed_bits_error_metrics( const size_t n, const uint64_t base, const void* data1, const void* data2,
+                                const metrics_layout& layout, const size_t threads, error_metrics& metrics )
+{
+    const unsigned char* bytes1 = (const unsigned char*)data1;
+    const unsigned char* bytes2 = (const unsigned char*)data2;
+    std::vector<uint8_t> items1, items2;
+    for ( size_t begin = 0; begin < n; begin += unpack_block_items )
+    {
+        const size_t count = std::min(n - begin, unpack_block_items);
+        unpack_bits(count, bytes1 + begin / 8, items1);
+        unpack_bits(count, bytes2 + begin / 8, items2);
+        parallel_error_metrics(count, base + begin, items1.data(), items2.data(), layout, threads, metrics);
+    }
+}
+
+comparison_kernels select_comparison_kernels( const tensor_file_header& header )
+{
+    switch ( header.item_type )
+    {
+        case item_float:
+            switch ( header.bits_per_item )
+            {
+                case 32: return typed_kernels<float>();
+                case 64: return typed_kernels<double>();
+            }
+            break;
+        case item_int:
+        case item_qint:
+            switch ( header.bits_per_item )
+            {
+                case 8: return typed_kernels<int8_t>();
+                case 16: return typed_kernels<int16_t>();
+                case 32: return typed_kernels<int32_t>();
+                case 64: return typed_kernels<int64_t>();
+            }
+            break;
+        case item_uint:
+        case item_quint:
+            switch ( header.bits_per_item )
+            {
+                case 8: return typed_kernels<uint8_t>();
+                case 16: return typed_kernels<uint16_t>();
+                case 32: return typed_kernels<uint32_t>();
+                case 64: return typed_kernels<uint64_t>();
+            }
+            break;
+        case item_bool:
+            if ( header.bits_per_item == 1 )
+            {
+                comparison_kernels kernels = { packed_bits_difference, packed_bits_error_metrics };
+                return kernels;
+            }
+            break;
+    }
+    comparison_kernels kernels = { nullptr, nullptr };
+    return kernels;
+}
+
+// Bytes mapped from each file at a time; bounds the memory used by streaming comparison
+const size_t stream_chunk_bytes = 64 << 20;
+
+struct stream_comparison
+{
+    double difference = 0;
+    bool exceeded = false;
+    uint64_t exceeded_begin = 0;
+    uint64_t exceeded_end = 0;
+    double exceeded_difference = 0;
+};
+
+// Compares the payloads of two tensor files with previously read headers; if metrics is not null,
+// the full error metrics are accumulated into it instead of the relative difference only;
+// each chunk is compared on up to the given number of threads
+bool stream_relative_difference( const std::string& path1, const std::string& path2,
+                                 const tensor_file_header& header1, const tensor_file_header& header2,
+                                 const double fail_fast, const metrics_layout& layout, const size_t threads, error_metrics* metrics,
+                                 stream_comparison& result, std::string& error )
+{
+    if ( header1.item_type != header2.item_type || header1.bits_per_item != header2.bits_per_item )
+    {
+        error = "data type mismatch: " + tensor_dtype(header1) + std::to_string(header1.bits_per_item) +
+                " vs " + tensor_dtype(header2) + std::to_string(header2.bits_per_item);
+        return false;
+    }
+    if ( header1.shape != header2.shape )
+    {
+        error = "shape mismatch: " + shape_string(header1.shape) + " vs " + shape_string(header2.shape);
+        return false;
+    }
+    const comparison_kernels kernels = select_comparison_kernels(header1);
+    if ( !kernels.difference )
+    {
+        error = "unsupported item type " + std::to_string(header1.item_type) + " with " +
+                std::to_string(header1.bits_per_item) + " bits per item";
+        return false;
+    }
+
+    mapped_file file1, file2;
+    if ( !file1.open(path1, error) || !file2.open(path2, error) )
+    {
+        return false;
+    }
+
+    const uint64_t bits = header1.bits_per_item;
+    const uint64_t count = std::accumulate(header1.shape.begin(), header1.shape.end(), (uint64_t)1, std::multiplies<uint64_t>());
+    const uint64_t chunk = std::max<uint64_t>(8, stream_chunk_bytes * 8 / bits / 8 * 8);
+
+    difference_sums sums;
+    for ( uint64_t begin = 0; begin < count; begin += chunk )
+    {
+        const uint64_t end = std::min(count, begin + chunk);
+        const uint64_t offset = tensor_header_size + begin * bits / 8;
+        const size_t length = (size_t)(((end - begin) * bits + 7) / 8);
+        if ( !file1.map(offset, length, error) || !file2.map(offset, length, error) )
+        {
+            return false;
+        }
+
+        difference_sums chunk_sums;
+        if ( metrics )
+        {
+            error_metrics chunk_metrics(layout);
+            kernels.metrics((size_t)(end - begin), begin, file1.data(), file2.data(), layout, threads, chunk_metrics);
+            metrics->add(chunk_metrics, layout.worst_count);
+            chunk_sums = chunk_metrics.sums;
+        }
+        else
+        {
+            chunk_sums = kernels.difference((size_t)(end - begin), file1.data(), file2.data(), threads);
+        }
+        sums.add(chunk_sums);
+
+        // a NaN difference fails too; an infinite threshold disables the check
+        const double chunk_difference = relative_difference(chunk_sums);
+        if ( std::isfinite(fail_fast) && !(chunk_difference <= fail_fast) )
+        {
+            result.exceeded = true;
+            result.exceeded_begin = begin;
+            result.exceeded_end = end;
+            result.exceeded_difference = chunk_difference;
+            break;
+        }
+    }
+    result.difference = relative_difference(sums);
+    return true;
+}
+
+void print_tensor_header( std::ostream& os, const nnef::Tensor& tensor )
+{
+    os << tensor.dtype << std::endl;
+    for ( size_t i = 0; i < tensor.shape.size(); ++i )
+    {
+        if ( i )
+        {
+            os << " ";
+        }
+        os << "1.." << tensor.shape[i];
+    }
+    os << std::endl;
+}
+
+// Output buffer written with one fwrite per MB; large contiguous blocks bypass the buffer
+class buffered_writer
+{
+public:
+
+    explicit buffered_writer( FILE* file )
+    : _file(file), _buffer(1 << 20), _size(0), _good(true)
+    {
+    }
+
+    ~buffered_writer()
+    {
+        flush();
+    }
+
+    void write( const char* data, const size_t size )
+    {
+        if ( _size + size > _buffer.size() )
+        {
+            flush();
+            if ( size >= _buffer.size() )
+            {
+                _good = _good && std::fwrite(data, 1, size, _file) == size;
+                return;
+            }
+        }
+        std::memcpy(_buffer.data() + _size, data, size);
+        _size += size;
+    }
+
+    void write( const std::string& str )
+    {
+        write(str.data(), str.size());
+    }
+
+    void put( const char ch )
+    {
+        if ( _size == _buffer.size() )
+        {
+            flush();
+        }
+        _buffer[_size++] = ch;
+    }
+
+    void write_value( const float value )
+    {
+        reserve(max_number_length);
+        // same format as the default formatting of std::ostream
+        _size += std::snprintf(_buffer.data() + _size, max_number_length, "%g", value);
+    }
+
+    void write_value( const int value )
+    {
+        reserve(max_number_length);
+        char digits[max_number_length];
+        size_t count = 0;
+        unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+        do
+        {
+            digits[count++] = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        }
+        while ( magnitude );
+        if ( value < 0 )
+        {
+            _buffer[_size++] = '-';
+        }
+        while ( count )
+        {
+            _buffer[_size++] = digits[--count];
+        }
+    }
+
+    void write_value( const bool value )
+    {
+        write(value ? "true" : "false", value ? 4 : 5);
+    }
+
+    bool flush()
+    {
+        if ( _size )
+        {
+            _good = _good && std::fwrite(_buffer.data(), 1, _size, _file) == _size;
+            _size = 0;
+        }
+        _good = _good && std::fflush(_file) == 0;
+        return _good;
+    }
+
+private:
+
+    static const size_t max_number_length = 32;
+
+    void reserve( const size_t size )
+    {
+        if ( _size + size > _buffer.size() )
+        {
+            flush();
+        }
+    }
+
+private:
+
+    FILE* _file;
+    std::vector<char> _buffer;
+    size_t _size;
+    bool _good;
+};
+
+// Selection of items along one axis, following Python slice semantics
+struct slice_range
+{
+    int begin;
+    int step;
+    int count;
+    bool single;    // a single index, which removes the axis from the result
+};
+
+bool parse_slice_index( const std::string& text, int& value, std::string& error )
+{
+    char* end;
+    const long parsed = std::strtol(text.c_str(), &end, 10);
+    if ( text.empty() || *end != '\0' )
+    {
+        error = "invalid slice index: '" + text + "'";
+        return false;
+    }
+    value = (int)parsed;
+    return true;
+}
+
+std::string trim( const std::string& str )
+{
+    const size_t begin = str.find_first_not_of(" \t");
+    const size_t end = str.find_last_not_of(" \t");
+    return begin == std::string::npos ? std::string() : str.substr(begin, end - begin + 1);
+}
+
+std::vector<std::string> split( const std::string& str, const char separator )
+{
+    std::vector<std::string> items;
+    size_t begin = 0;
+    for ( size_t end; (end = str.find(separator, begin)) != std::string::npos; begin = end + 1 )
+    {
+        items.push_back(trim(str.substr(begin, end - begin)));
+    }
+    items.push_back(trim(str.substr(begin)));
+    return items;
+}
+
+bool parse_slice_range( const std::string& text, const int extent, slice_range& range, std::string& error )
+{
+    const std::vector<std::string> parts = split(text, ':');
+    if ( parts.size() == 1 )
+    {
+        int index;
+        if ( !parse_slice_index(parts[0], index, error) )
+        {
+            return false;
+        }
+        if ( index < -extent || index >= extent )
+        {
+            error = "slice index " + parts[0] + " out of range 0.." + std::to_string(extent - 1);
+            return false;
+        }
+        range.begin = index < 0 ? index + extent : index;
+        range.step = 1;
+        range.count = 1;
+        range.single = true;
+        return true;
+    }
+    if ( parts.size() > 3 )
+    {
+        error = "invalid slice: '" + text + "'";
+        return false;
+    }
+
+    int step = 1;
+    if ( parts.size() == 3 && !parts[2].empty() && !parse_slice_index(parts[2], step, error) )
+    {
+        return false;
+    }
+    if ( step == 0 )
+    {
+        error = "slice step cannot be zero";
+        return false;
+    }
+
+    const int lower = step > 0 ? 0 : -1;
+    const int upper = step > 0 ? extent : extent - 1;
+    int bounds[2] = { step > 0 ? lower : upper, step > 0 ? upper : lower };
+    for ( size_t i = 0; i < 2; ++i )
+    {
+        if ( !parts[i].empty() )
+        {
+            int value;
+            if ( !parse_slice_index(parts[i], value, error) )
+            {
+                return false;
+            }
+            if ( value < 0 )
+            {
+                value += extent;
+            }
+            bounds[i] = std::max(lower, std::min(upper, value));
+        }
+    }
+
+    range.begin = bounds[0];
+    range.step = step;
+    range.count = step > 0 ? std::max(0, (bounds[1] - bounds[0] + step - 1) / step)
+                           : std::max(0, (bounds[0] - bounds[1] - step - 1) / -step);
+    range.single = false;
+    return true;
+}
+
+// Parses a selector like "[0, :, 10:20]"; axes not mentioned are selected entirely
+bool parse_slice( const std::string& text, const std::vector<int>& shape, std::vector<slice_range>& ranges, std::string& error )
+{
+    std::string body = trim(text);
+    if ( body.size() >= 2 && body.front() == '[' && body.back() == ']' )
+    {
+        body = body.substr(1, body.size() - 2);
+    }
+    const std::vector<std::string> items = trim(body).empty() ? std::vector<std::string>() : split(body, ',');
+    if ( items.size() > shape.size() )
+    {
+        error = "slice has more items than tensor rank " + std::to_string(shape.size());
+        return false;
+    }
+
+    ranges.resize(shape.size());
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        if ( !parse_slice_range(i < items.size() ? items[i] : ":", shape[i], ranges[i], error) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<slice_range> full_slice( const std::vector<int>& shape )
+{
+    std::vector<slice_range> ranges(shape.size());
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        ranges[i].begin = 0;
+        ranges[i].step = 1;
+        ranges[i].count = shape[i];
+        ranges[i].single = false;
+    }
+    return ranges;
+}
+
+std::vector<int> slice_shape( const std::vector<slice_range>& ranges )
+{
+    std::vector<int> shape;
+    for ( const auto& range : ranges )
+    {
+        if ( !range.single )
+        {
+            shape.push_back(range.count);
+        }
+    }
+    return shape;
+}
+
+// Calls func(offset, count, step) for each run of selected items along the last axis that
+// selects more than one item, in row-major order; offset and step are in items of the whole
+// tensor. Axes after the run axis select a single item and only add to the offset
+template <typename F>
+void for_each_slice_run( const std::vector<int>& shape, const std::vector<slice_range>& ranges, F func )
+{
+    const size_t rank = shape.size();
+    if ( rank == 0 )
+    {
+        func((size_t)0, (size_t)1, (ptrdiff_t)1);
+        return;
+    }
+
+    std::vector<ptrdiff_t> strides(rank);
+    ptrdiff_t stride = 1;
+    for ( size_t i = rank; i--; )
+    {
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+    for ( const auto& range : ranges )
+    {
+        if ( range.count == 0 )
+        {
+            return;
+        }
+    }
+
+    size_t run_axis = rank - 1;
+    while ( run_axis && ranges[run_axis].count == 1 )
+    {
+        --run_axis;
+    }
+    ptrdiff_t base = 0;
+    for ( size_t i = run_axis; i < rank; ++i )
+    {
+        base += (ptrdiff_t)ranges[i].begin * strides[i];
+    }
+
+    std::vector<int> position(run_axis, 0);
+    const slice_range& run = ranges[run_axis];
+    while ( true )
+    {
+        ptrdiff_t offset = base;
+        for ( size_t i = 0; i < run_axis; ++i )
+        {
+            offset += ((ptrdiff_t)ranges[i].begin + (ptrdiff_t)position[i] * ranges[i].step) * strides[i];
+        }
+        func((size_t)offset, (size_t)run.count, (ptrdiff_t)run.step * strides[run_axis]);
+
+        size_t axis = run_axis;
+        while ( axis-- )
+        {
+            if ( ++position[axis] < ranges[axis].count )
+            {
+                break;
+            }
+            position[axis] = 0;
+        }
+        if ( axis == (size_t)-1 )
+        {
+            return;
+        }
+    }
+}
+
+enum export_format
+{
+    format_text,
+    format_csv,
+    format_npy,
+};
+
+bool parse_export_format( const std::string& name, export_format& format )
+{
+    if ( name == "text" )
+    {
+        format = format_text;
+    }
+    else if ( name == "csv" )
+    {
+        format = format_csv;
+    }
+    else if ( name == "npy" )
+    {
+        format = format_npy;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void write_tensor_header( buffered_writer& writer, const std::string& dtype, const std::vector<int>& shape )
+{
+    writer.write(dtype);
+    writer.put('\n');
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        if ( i )
+        {
+            writer.put(' ');
+        }
+        writer.write("1..");
+        writer.write_value(shape[i]);
+    }
+    writer.put('\n');
+}
+
+// Text has one item per line; CSV has one row per run along the last selected axis that has
+// more than one item, so trailing single-index axes do not split rows
+template <typename T>
+void write_text_data( buffered_writer& writer, const T* data, const std::vector<int>& shape,
+                      const std::vector<slice_range>& ranges, const bool csv )
+{
+    const bool rows = csv && slice_shape(ranges).size() >= 2;
+    for_each_slice_run(shape, ranges, [&writer, data, rows]( const size_t offset, const size_t count, const ptrdiff_t step )
+    {
+        const T* item = data + offset;
+        for ( size_t i = 0; i < count; ++i, item += step )
+        {
+            if ( rows && i )
+            {
+                writer.put(',');
+            }
+            writer.write_value(*item);
+            if ( !rows )
+            {
+                writer.put('\n');
+            }
+        }
+        if ( rows )
+        {
+            writer.put('\n');
+        }
+    });
+}
+
+std::string npy_descr( const std::string& dtype )
+{
+    if ( dtype == "scalar" )
+    {
+        return "<f4";
+    }
+    else if ( dtype == "integer" )
+    {
+        return "<i4";
+    }
+    return "|b1";
+}
+
+void write_npy_header( buffered_writer& writer, const std::string& dtype, const std::vector<int>& shape )
+{
+    std::string dict = "{'descr': '" + npy_descr(dtype) + "', 'fortran_order': False, 'shape': (";
+    for ( size_t i = 0; i < shape.size(); ++i )
+    {
+        dict += std::to_string(shape[i]) + (shape.size() == 1 ? "," : i + 1 < shape.size() ? ", " : "");
+    }
+    dict += "), }";
+
+    // magic, version 1.0 and header length take 10 bytes; total header size is padded to 64 bytes
+    const size_t length = (10 + dict.size() + 1 + 63) / 64 * 64 - 10;
+    dict.resize(length - 1, ' ');
+    dict += '\n';
+
+    const char preamble[10] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0, (char)(length & 0xFF), (char)(length >> 8) };
+    writer.write(preamble, sizeof(preamble));
+    writer.write(dict);
+}
+
+// Contiguous runs are written directly from the tensor buffer, strided runs are gathered
+template <typename T>
+void write_npy_data( buffered_writer& writer, const T* data, const std::vector<int>& shape,
+                     const std::vector<slice_range>& ranges )
+{
+    for_each_slice_run(shape, ranges, [&writer, data]( const size_t offset, const size_t count, const ptrdiff_t step )
+    {
+        if ( step == 1 )
+        {
+            writer.write((const char*)(data + offset), count * sizeof(T));
+        }
+        else
+        {
+            const T* item = data + offset;
+            for ( size_t i = 0; i < count; ++i, item += step )
+            {
+                writer.write((const char*)item, sizeof(T));
+            }
+        }
+    });
+}
+
 template <typename T>
-T sqr( const T x )
+void write_data( buffered_writer& writer, const T* data, const std::vector<int>& shape,
+                 const std::vector<slice_range>& ranges, const export_format format )
 {
-    return x * x;
+    if ( format == format_npy )
+    {
+        write_npy_data(writer, data, shape, ranges);
+    }
+    else
+    {
+        write_text_data(writer, data, shape, ranges, format == format_csv);
+    }
 }
 
-template <typename T>
-T relative_data_difference( const size_t n, const T* data1, const T* data2 )
+bool export_tensor( FILE* file, const nnef::Tensor& tensor, const std::vector<slice_range>& ranges,
+                    const export_format format, std::string& error )
 {
-    T diff = 0;
-    T range = 0;
-    for ( size_t i = 0; i < n; ++i )
+    buffered_writer writer(file);
+    const std::vector<int> shape = slice_shape(ranges);
+    if ( format == format_npy )
     {
-        diff += sqr(data2[i] - data1[i]);
-        range += sqr(data1[i]);
+        write_npy_header(writer, tensor.dtype, shape);
     }
-    return std::sqrt(diff / range);
+    else if ( format == format_text )
+    {
+        write_tensor_header(writer, tensor.dtype, shape);
+    }
+
+    if ( tensor.dtype == "scalar" )
+    {
+        write_data(writer, (const float*)tensor.data.data(), tensor.shape, ranges, format);
+    }
+    else if ( tensor.dtype == "integer" )
+    {
+        write_data(writer, (const int*)tensor.data.data(), tensor.shape, ranges, format);
+    }
+    else if ( tensor.dtype == "logical" )
+    {
+        write_data(writer, (const bool*)tensor.data.data(), tensor.shape, ranges, format);
+    }
+    else
+    {
+        error = "unsupported data type: " + tensor.dtype;
+        return false;
+    }
+
+    if ( !writer.flush() )
+    {
+        error = "could not write tensor data";
+        return false;
+    }
+    return true;
 }
 
-int volume(const nnef::Tensor& tensor)
+std::string index_string( uint64_t index, const std::vector<int>& shape )
 {
-    const std::vector<int>& shape = tensor.shape;
-    return std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
+    std::vector<int> coords(shape.size());
+    for ( size_t i = shape.size(); i--; )
+    {
+        coords[i] = (int)(index % shape[i]);
+        index /= shape[i];
+    }
+    return shape_string(coords);
 }
 
-template <typename T>
-T relative_difference( const nnef::Tensor& tensor1, const nnef::Tensor& tensor2 )
+std::vector<element_error> sorted_worst( const error_metrics& metrics )
 {
-    size_t volume1 = volume(tensor1);
-    size_t volume2 = volume(tensor2);
-    return relative_data_difference(std::min(volume1, volume2),
-        (const T*) tensor1.data.data(),
-        (const T*) tensor2.data.data());
+    std::vector<element_error> worst = metrics.worst;
+    std::sort_heap(worst.begin(), worst.end());
+    return worst;
 }
 
-void print_tensor_header( std::ostream& os, const nnef::Tensor& tensor )
+void print_error_metrics( std::ostream& os, const error_metrics& metrics, const std::vector<int>& shape, const int axis )
 {
-    os << tensor.dtype << std::endl;
-    for ( size_t i = 0; i < tensor.shape.size(); ++i )
+    os << "max absolute error:" << std::endl;
+    os << metrics.max_abs_error << " at " << index_string(metrics.max_abs_index, shape) << std::endl;
+    os << "max relative error:" << std::endl;
+    os << metrics.max_rel_error << " at " << index_string(metrics.max_rel_index, shape) << std::endl;
+    os << "max ulp distance:" << std::endl;
+    os << metrics.max_ulp << " at " << index_string(metrics.max_ulp_index, shape) << std::endl;
+    os << "mean ulp distance:" << std::endl;
+    os << metrics.mean_ulp() << std::endl;
+    os << "cosine similarity:" << std::endl;
+    os << metrics.cosine_similarity() << std::endl;
+    os << "nan mismatches:" << std::endl;
+    os << metrics.nan_mismatches << std::endl;
+    os << "inf mismatches:" << std::endl;
+    os << metrics.inf_mismatches << std::endl;
+    os << "non-finite pairs (excluded from the metrics above):" << std::endl;
+    os << metrics.non_finite_count() << std::endl;
+    if ( !metrics.channels.empty() )
     {
-        if ( i )
+        os << "axis " << axis << " relative difference, max absolute error:" << std::endl;
+        for ( size_t i = 0; i < metrics.channels.size(); ++i )
         {
-            os << " ";
+            const channel_error& channel = metrics.channels[i];
+            os << i << ": " << relative_difference(channel.sums) << " " << channel.max_abs_error << std::endl;
+        }
+    }
+    if ( !metrics.worst.empty() )
+    {
+        os << "worst items (value #1, value #2, absolute error):" << std::endl;
+        for ( const auto& item : sorted_worst(metrics) )
+        {
+            os << index_string(item.index, shape) << ": " << item.value1 << " " << item.value2 << " " << item.abs_error << std::endl;
         }
-        os << "1.." << tensor.shape[i];
     }
-    os << std::endl;
 }
 
-template <typename T>
-void print_data( std::ostream& os, const size_t n, const T* data )
+void print_json_number( std::ostream& os, const double value )
 {
-    for ( size_t i = 0; i < n; ++i )
+    if ( std::isfinite(value) )
+    {
+        os << value;
+    }
+    else
     {
-        os << data[i] << std::endl;
+        os << "null";
     }
 }
 
-void print_tensor_data( std::ostream& os, const nnef::Tensor& tensor )
+void print_json_tensor_header( std::ostream& os, const nnef::Tensor& tensor )
 {
-    size_t vol = volume(tensor);
-    if ( tensor.dtype == "scalar" )
+    os << "{\"dtype\": \"" << tensor.dtype << "\", \"shape\": " << shape_string(tensor.shape) << "}";
+}
+
+void print_json_comparison( std::ostream& os, const nnef::Tensor& tensor1, const nnef::Tensor& tensor2,
+                            const stream_comparison& result, const error_metrics* metrics, const int axis )
+{
+    const std::streamsize precision = os.precision(std::numeric_limits<double>::max_digits10);
+    os << "{" << std::endl;
+    os << "  \"tensor1\": ";
+    print_json_tensor_header(os, tensor1);
+    os << "," << std::endl << "  \"tensor2\": ";
+    print_json_tensor_header(os, tensor2);
+    os << "," << std::endl << "  \"relative_difference\": ";
+    print_json_number(os, result.difference);
+    if ( result.exceeded )
     {
-        print_data(os, vol, (float *)tensor.data.data());
+        os << "," << std::endl << "  \"exceeded\": {\"begin\": " << result.exceeded_begin << ", \"end\": " << result.exceeded_end;
+        os << ", \"relative_difference\": ";
+        print_json_number(os, result.exceeded_difference);
+        os << "}";
     }
-    else if ( tensor.dtype == "integer" )
+    if ( metrics )
+    {
+        os << "," << std::endl << "  \"max_absolute_error\": {\"value\": ";
+        print_json_number(os, metrics->max_abs_error);
+        os << ", \"index\": " << index_string(metrics->max_abs_index, tensor1.shape) << "}";
+        os << "," << std::endl << "  \"max_relative_error\": {\"value\": ";
+        print_json_number(os, metrics->max_rel_error);
+        os << ", \"index\": " << index_string(metrics->max_rel_index, tensor1.shape) << "}";
+        os << "," << std::endl << "  \"max_ulp_distance\": {\"value\": " << metrics->max_ulp;
+        os << ", \"index\": " << index_string(metrics->max_ulp_index, tensor1.shape) << "}";
+        os << "," << std::endl << "  \"mean_ulp_distance\": ";
+        print_json_number(os, metrics->mean_ulp());
+        os << "," << std::endl << "  \"cosine_similarity\": ";
+        print_json_number(os, metrics->cosine_similarity());
+        os << "," << std::endl << "  \"nan_mismatches\": " << metrics->nan_mismatches;
+        os << "," << std::endl << "  \"inf_mismatches\": " << metrics->inf_mismatches;
+        os << "," << std::endl << "  \"non_finite_pairs\": " << metrics->non_finite_count();
+        if ( !metrics->channels.empty() )
+        {
+            os << "," << std::endl << "  \"axis\": " << axis << "," << std::endl << "  \"channels\": [";
+            for ( size_t i = 0; i < metrics->channels.size(); ++i )
+            {
+                const channel_error& channel = metrics->channels[i];
+                os << (i ? "," : "") << std::endl << "    {\"relative_difference\": ";
+                print_json_number(os, relative_difference(channel.sums));
+                os << ", \"max_absolute_error\": ";
+                print_json_number(os, channel.max_abs_error);
+                os << "}";
+            }
+            os << std::endl << "  ]";
+        }
+        if ( !metrics->worst.empty() )
+        {
+            os << "," << std::endl << "  \"worst\": [";
+            bool first = true;
+            for ( const auto& item : sorted_worst(*metrics) )
+            {
+                os << (first ? "" : ",") << std::endl << "    {\"index\": " << index_string(item.index, tensor1.shape);
+                os << ", \"value1\": ";
+                print_json_number(os, item.value1);
+                os << ", \"value2\": ";
+                print_json_number(os, item.value2);
+                os << ", \"absolute_error\": ";
+                print_json_number(os, item.abs_error);
+                os << "}";
+                first = false;
+            }
+            os << std::endl << "  ]";
+        }
+    }
+    os << std::endl << "}" << std::endl;
+    os.precision(precision);
+}
+
+bool is_directory( const std::string& path )
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+bool list_directory( const std::string& path, std::vector<std::string>& names, std::string& error )
+{
+#ifdef _WIN32
+    struct _finddata_t data;
+    intptr_t handle = _findfirst((path + "/*").c_str(), &data);
+    if ( handle == -1 )
+    {
+        error = "could not read directory: " + path;
+        return false;
+    }
+    do
+    {
+        names.push_back(data.name);
+    }
+    while ( _findnext(handle, &data) == 0 );
+    _findclose(handle);
+#else
+    DIR* dir = opendir(path.c_str());
+    if ( !dir )
+    {
+        error = "could not read directory: " + path;
+        return false;
+    }
+    while ( const struct dirent* entry = readdir(dir) )
+    {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    return true;
+}
+
+// One operation output traced by infer --trace into a file named trace<index>-<id>.dat
+struct trace_entry
+{
+    unsigned index;
+    std::string id;
+    std::string path1;
+    std::string path2;
+    bool compared = false;
+    double difference = 0;
+    std::string error;
+
+    bool operator<( const trace_entry& other ) const
+    {
+        return index != other.index ? index < other.index : id < other.id;
+    }
+};
+
+bool parse_trace_name( const std::string& name, unsigned& index, std::string& id )
+{
+    const std::string prefix = "trace";
+    const std::string suffix = ".dat";
+    if ( name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+         name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0 )
+    {
+        return false;
+    }
+    const size_t dash = name.find('-', prefix.size());
+    if ( dash == std::string::npos || dash == prefix.size() )
+    {
+        return false;
+    }
+    for ( size_t i = prefix.size(); i < dash; ++i )
+    {
+        if ( !std::isdigit((unsigned char)name[i]) )
+        {
+            return false;
+        }
+    }
+    index = (unsigned)std::atol(name.substr(prefix.size(), dash - prefix.size()).c_str());
+    id = name.substr(dash + 1, name.size() - suffix.size() - dash - 1);
+    return true;
+}
+
+bool pair_trace_files( const std::string& dir1, const std::string& dir2, std::vector<trace_entry>& entries, std::string& error )
+{
+    std::vector<std::string> names1, names2;
+    if ( !list_directory(dir1, names1, error) || !list_directory(dir2, names2, error) )
+    {
+        return false;
+    }
+
+    std::map<std::pair<unsigned, std::string>, trace_entry> pairs;
+    for ( const auto& name : names1 )
+    {
+        trace_entry entry;
+        if ( parse_trace_name(name, entry.index, entry.id) )
+        {
+            entry.path1 = dir1 + "/" + name;
+            pairs[std::make_pair(entry.index, entry.id)] = entry;
+        }
+    }
+    for ( const auto& name : names2 )
+    {
+        trace_entry entry;
+        if ( parse_trace_name(name, entry.index, entry.id) )
+        {
+            trace_entry& pair = pairs[std::make_pair(entry.index, entry.id)];
+            pair.index = entry.index;
+            pair.id = entry.id;
+            pair.path2 = dir2 + "/" + name;
+        }
+    }
+
+    for ( auto& item : pairs )
+    {
+        trace_entry& entry = item.second;
+        if ( entry.path1.empty() || entry.path2.empty() )
+        {
+            entry.error = "missing in " + (entry.path1.empty() ? dir1 : dir2);
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+// Compares all pairs on a pool of at most max_workers threads; each comparison is single
+// threaded and streamed, so memory use does not depend on tensor sizes
+void compare_trace_files( std::vector<trace_entry>& entries, const size_t max_workers )
+{
+    const size_t workers = std::max<size_t>(1, std::min(max_workers, entries.size()));
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for ( size_t t = 0; t < workers; ++t )
+    {
+        threads.emplace_back([&entries, &next]()
+        {
+            for ( size_t i = next++; i < entries.size(); i = next++ )
+            {
+                trace_entry& entry = entries[i];
+                if ( !entry.error.empty() )
+                {
+                    continue;
+                }
+                tensor_file_header header1, header2;
+                stream_comparison result;
+                const metrics_layout layout;
+                if ( read_tensor_header(entry.path1, header1, entry.error) &&
+                     read_tensor_header(entry.path2, header2, entry.error) &&
+                     stream_relative_difference(entry.path1, entry.path2, header1, header2,
+                                                std::numeric_limits<double>::infinity(), layout, 1, nullptr, result, entry.error) )
+                {
+                    entry.compared = true;
+                    entry.difference = result.difference;
+                }
+            }
+        });
+    }
+    for ( auto& thread : threads )
+    {
+        thread.join();
+    }
+}
+
+const trace_entry* first_diverging( const std::vector<trace_entry>& entries, const double tolerance )
+{
+    for ( const auto& entry : entries )
+    {
+        if ( !entry.compared || !(entry.difference <= tolerance) )
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+std::string trace_name( const trace_entry& entry )
+{
+    std::string index = std::to_string(entry.index);
+    return std::string(index.size() < 3 ? 3 - index.size() : 0, '0') + index + " " + entry.id;
+}
+
+void print_trace_comparison( std::ostream& os, const std::vector<trace_entry>& entries, const double tolerance )
+{
+    os << "error growth:" << std::endl;
+    for ( const auto& entry : entries )
+    {
+        os << trace_name(entry) << ": ";
+        if ( entry.compared )
+        {
+            os << entry.difference << std::endl;
+        }
+        else
+        {
+            os << entry.error << std::endl;
+        }
+    }
+    const trace_entry* first = first_diverging(entries, tolerance);
+    os << "first diverging operation:" << std::endl;
+    if ( first )
+    {
+        os << trace_name(*first) << ": ";
+        if ( first->compared )
+        {
+            os << first->difference << std::endl;
+        }
+        else
+        {
+            os << first->error << std::endl;
+        }
+    }
+    else
+    {
+        os << "none" << std::endl;
+    }
+}
+
+void print_json_string( std::ostream& os, const std::string& str )
+{
+    os << '"';
+    for ( const char ch : str )
+    {
+        if ( ch == '"' || ch == '\\' )
+        {
+            os << '\\' << ch;
+        }
+        else if ( (unsigned char)ch < 0x20 )
+        {
+            os << ' ';
+        }
+        else
+        {
+            os << ch;
+        }
+    }
+    os << '"';
+}
+
+void print_json_trace_entry( std::ostream& os, const trace_entry& entry )
+{
+    os << "{\"index\": " << entry.index << ", \"id\": ";
+    print_json_string(os, entry.id);
+    if ( entry.compared )
     {
-        print_data(os, vol, (int *)tensor.data.data());
+        os << ", \"relative_difference\": ";
+        print_json_number(os, entry.difference);
     }
-    else if ( tensor.dtype == "boolean" )
+    else
     {
-        print_data(os, vol, (bool *)tensor.data.data());
+        os << ", \"error\": ";
+        print_json_string(os, entry.error);
     }
+    os << "}";
 }
 
-std::ostream& operator<<( std::ostream& os, const nnef::Tensor& tensor )
+void print_json_trace_comparison( std::ostream& os, const std::vector<trace_entry>& entries, const double tolerance )
 {
-    print_tensor_header(os, tensor);
-    print_tensor_data(os, tensor);
-    return os;
+    const std::streamsize precision = os.precision(std::numeric_limits<double>::max_digits10);
+    os << "{" << std::endl << "  \"tolerance\": ";
+    print_json_number(os, tolerance);
+    os << "," << std::endl << "  \"first_diverging\": ";
+    const trace_entry* first = first_diverging(entries, tolerance);
+    if ( first )
+    {
+        print_json_trace_entry(os, *first);
+    }
+    else
+    {
+        os << "null";
+    }
+    os << "," << std::endl << "  \"tensors\": [";
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        os << (i ? "," : "") << std::endl << "    ";
+        print_json_trace_entry(os, entries[i]);
+    }
+    os << std::endl << "  ]" << std::endl << "}" << std::endl;
+    os.precision(precision);
 }
 
 int main( int argc, const char * argv[] )
 {
     std::string error;
+    std::vector<std::string> files;
+    bool stream = false;
+    double fail_fast = std::numeric_limits<double>::infinity();
+    bool metrics_enabled = false;
+    bool json = false;
+    int axis = -1;
+    size_t worst_count = 0;
+    double tolerance = 1e-4;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    export_format format = format_text;
+    std::string slice;
+    std::string output;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const std::string arg = argv[i];
+        if ( arg == "--stream" )
+        {
+            stream = true;
+        }
+        else if ( arg == "--fail-fast" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Threshold must be provided after --fail-fast; ignoring option" << std::endl;
+            }
+            else
+            {
+                fail_fast = std::atof(argv[++i]);
+                stream = true;
+            }
+        }
+        else if ( arg == "--metrics" )
+        {
+            metrics_enabled = true;
+        }
+        else if ( arg == "--json" )
+        {
+            json = true;
+            metrics_enabled = true;
+        }
+        else if ( arg == "--axis" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Axis must be provided after --axis; ignoring option" << std::endl;
+            }
+            else
+            {
+                axis = std::atoi(argv[++i]);
+                metrics_enabled = true;
+            }
+        }
+        else if ( arg == "--worst" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Item count must be provided after --worst; ignoring option" << std::endl;
+            }
+            else
+            {
+                worst_count = (size_t)std::atol(argv[++i]);
+                metrics_enabled = true;
+            }
+        }
+        else if ( arg == "--tolerance" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Tolerance must be provided after --tolerance; ignoring option" << std::endl;
+            }
+            else
+            {
+                tolerance = std::atof(argv[++i]);
+            }
+        }
+        else if ( arg == "--threads" )
+        {
+            if ( i + 1 == argc || std::atoi(argv[i+1]) <= 0 )
+            {
+                std::cerr << "Positive thread count must be provided after --threads; ignoring option" << std::endl;
+            }
+            else
+            {
+                max_threads = (size_t)std::atoi(argv[++i]);
+            }
+        }
+        else if ( arg == "--format" )
+        {
+            if ( i + 1 == argc || !parse_export_format(argv[i+1], format) )
+            {
+                std::cerr << "Format text, csv or npy must be provided after --format; ignoring option" << std::endl;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        else if ( arg == "--slice" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Selector must be provided after --slice; ignoring option" << std::endl;
+            }
+            else
+            {
+                slice = argv[++i];
+            }
+        }
+        else if ( arg == "--output" )
+        {
+            if ( i + 1 == argc )
+            {
+                std::cerr << "Output file name must be provided after --output; ignoring option" << std::endl;
+            }
+            else
+            {
+                output = argv[++i];
+            }
+        }
+        else if ( arg.compare(0, 2, "--") == 0 )
+        {
+            std::cerr << "Unrecognized option: " << argv[i] << "; ignoring" << std::endl;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
 
-    if ( argc == 2 )
+    if ( files.size() == 1 )
     {
         nnef::Tensor tensor;
-        if ( !nnef::read_tensor(argv[1], tensor, error) )
+        if ( !nnef::read_tensor(files[0], tensor, error) )
         {
             std::cerr << error << std::endl;
             return -1;
         }
-        std::cout << tensor;
+        std::vector<slice_range> ranges = full_slice(tensor.shape);
+        if ( !slice.empty() && !parse_slice(slice, tensor.shape, ranges, error) )
+        {
+            std::cerr << error << std::endl;
+            return -2;
+        }
+
+        FILE* file = stdout;
+        if ( !output.empty() )
+        {
+            file = std::fopen(output.c_str(), format == format_npy ? "wb" : "w");
+            if ( !file )
+            {
+                std::cerr << "could not open output file: " << output << std::endl;
+                return -3;
+            }
+        }
+#ifdef _WIN32
+        else if ( format == format_npy )
+        {
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+#endif
+        const bool exported = export_tensor(file, tensor, ranges, format, error);
+        if ( file != stdout )
+        {
+            std::fclose(file);
+        }
+        if ( !exported )
+        {
+            std::cerr << error << std::endl;
+            return -4;
+        }
     }
-    else if ( argc == 3 )
+    else if ( files.size() == 2 && is_directory(files[0]) && is_directory(files[1]) )
     {
-        nnef::Tensor tensor1, tensor2;
-        if ( !nnef::read_tensor(argv[1], tensor1, error) )
+        std::vector<trace_entry> entries;
+        if ( !pair_trace_files(files[0], files[1], entries, error) )
         {
-	    std::cerr << error << std::endl;
+            std::cerr << error << std::endl;
             return -2;
         }
-        if ( !nnef::read_tensor(argv[2], tensor2, error) )
+        compare_trace_files(entries, max_threads);
+        if ( json )
+        {
+            print_json_trace_comparison(std::cout, entries, tolerance);
+        }
+        else
+        {
+            print_trace_comparison(std::cout, entries, tolerance);
+        }
+        if ( first_diverging(entries, tolerance) )
+        {
+            return 1;
+        }
+    }
+    else if ( files.size() == 2 )
+    {
+        nnef::Tensor tensor1, tensor2;
+        tensor_file_header header1, header2;
+        if ( stream )
+        {
+            if ( !read_tensor_header(files[0], header1, error) )
+            {
+                std::cerr << error << std::endl;
+                return -2;
+            }
+            if ( !read_tensor_header(files[1], header2, error) )
+            {
+                std::cerr << error << std::endl;
+                return -3;
+            }
+            tensor1.dtype = tensor_dtype(header1);
+            tensor1.shape = header1.shape;
+            tensor2.dtype = tensor_dtype(header2);
+            tensor2.shape = header2.shape;
+        }
+        else
+        {
+            if ( !nnef::read_tensor(files[0], tensor1, error) )
+            {
+                std::cerr << error << std::endl;
+                return -2;
+            }
+            if ( !nnef::read_tensor(files[1], tensor2, error) )
+            {
+                std::cerr << error << std::endl;
+                return -3;
+            }
+        }
+
+        metrics_layout layout;
+        if ( !make_metrics_layout(tensor1.shape, axis, worst_count, layout, error) )
+        {
+            std::cerr << error << std::endl;
+            return -4;
+        }
+        error_metrics metrics(layout);
+        stream_comparison result;
+
+        bool compared;
+        if ( stream )
+        {
+            compared = stream_relative_difference(files[0], files[1], header1, header2, fail_fast, layout, max_threads,
+                                                  metrics_enabled ? &metrics : nullptr, result, error);
+        }
+        else if ( metrics_enabled )
+        {
+            compared = error_metrics_difference(tensor1, tensor2, layout, max_threads, metrics, error);
+            result.difference = relative_difference(metrics.sums);
+        }
+        else
+        {
+            compared = relative_difference(tensor1, tensor2, max_threads, result.difference, error);
+        }
+        if ( !compared )
         {
             std::cerr << error << std::endl;
-            return -3;
+            return -4;
         }
-        float diff = relative_difference<float>(tensor1, tensor2);
+
+        if ( json )
+        {
+            print_json_comparison(std::cout, tensor1, tensor2, result, &metrics, axis);
+            return result.exceeded ? 1 : 0;
+        }
+
         std::cout << "tensor #1:" << std::endl;
         print_tensor_header(std::cout, tensor1);
         std::cout << "tensor #2:" << std::endl;
         print_tensor_header(std::cout, tensor2);
-        std::cout << "relative difference:" << std::endl;
-        std::cout << diff << std::endl;
+        if ( result.exceeded )
+        {
+            std::cout << "tolerance exceeded in items " << result.exceeded_begin << ".." << result.exceeded_end - 1 << ":" << std::endl;
+            std::cout << result.exceeded_difference << std::endl;
+            std::cout << "relative difference up to item " << result.exceeded_end - 1 << ":" << std::endl;
+        }
+        else
+        {
+            std::cout << "relative difference:" << std::endl;
+        }
+        std::cout << result.difference << std::endl;
+        if ( metrics_enabled )
+        {
+            print_error_metrics(std::cout, metrics, tensor1.shape, axis);
+        }
+        if ( result.exceeded )
+        {
+            return 1;
+        }
     }
     else
     {
-        std::cerr << "Only 1 (info) or 2 (compare) parameters supported" << std::endl;
-        std::cerr << error << std::endl;
+        std::cerr << "Only 1 (info) or 2 (compare) file names, or 2 trace directories supported" << std::endl;
+        std::cerr << "Options: --stream, --fail-fast <threshold>, --metrics, --axis <axis>, --worst <count>, --json," << std::endl;
+        std::cerr << "         --tolerance <threshold>, --threads <count>," << std::endl;
+        std::cerr << "         --format text|csv|npy, --slice <selector>, --output <file>" << std::endl;
         return -1;
     }
     
@@ -0,0 +1,168 @@
+// Definitions shared by the tools: graph loading options, identifier traversal and
+// the planning of static storage for intermediate tensors
+
+#ifndef _NNEF_TOOLS_COMMON_H_
+#define _NNEF_TOOLS_COMMON_H_
+
+#include "nnef.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const std::set<std::string> lowered =
+{
+    "separable_conv",
+    "separable_deconv",
+    "rms_pool",
+    "local_response_normalization",
+    "local_mean_normalization",
+    "local_variance_normalization",
+    "local_contrast_normalization",
+    "l1_normalization",
+    "l2_normalization",
+    "batch_normalization",
+    "area_downsample",
+    "nearest_downsample",
+    "nearest_upsample",
+    "linear_quantize",
+    "logarithmic_quantize",
+    "leaky_relu",
+    "prelu",
+    "clamp",
+};
+
+inline std::string read_file( const char* fn )
+{
+    std::ifstream is(fn);
+    if ( !is )
+    {
+        throw std::runtime_error("file not found: " + std::string(fn));
+    }
+
+    return std::string((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+}
+
+inline void collect_identifiers( const nnef::Value& value, std::vector<std::string>& ids )
+{
+    if ( value.kind() == nnef::Value::Kind::Identifier )
+    {
+        ids.push_back(value.identifier());
+    }
+    else if ( value.kind() == nnef::Value::Kind::Array || value.kind() == nnef::Value::Kind::Tuple )
+    {
+        for ( size_t i = 0; i < value.size(); ++i )
+        {
+            collect_identifiers(value[i], ids);
+        }
+    }
+}
+
+// Storage of intermediate tensors in one static buffer; tensors whose lifetimes
+// do not overlap share the same storage
+struct storage_plan
+{
+    std::unordered_map<std::string, size_t> offsets;
+    size_t size = 0;
+    size_t unshared_size = 0;
+};
+
+// Assigns storage of the given sizes first fit in order of definition. released(a, b) tells
+// that every use of the a-th intermediate happens before the b-th is defined, so they may
+// share storage, and retired(a, b) that the a-th is also released for all later ones
+template <typename Released, typename Retired>
+storage_plan allocate_storage( const std::vector<std::string>& intermediates, const std::vector<size_t>& sizes,
+                               Released released, Retired retired )
+{
+    struct block
+    {
+        size_t offset;
+        size_t size;
+        size_t index;
+    };
+    std::vector<block> live;    // sorted by offset
+
+    storage_plan plan;
+    for ( size_t k = 0; k < intermediates.size(); ++k )
+    {
+        const size_t size = sizes[k];
+        plan.unshared_size += size;
+
+        live.erase(std::remove_if(live.begin(), live.end(), [&]( const block& b ){ return retired(b.index, k); }), live.end());
+
+        size_t offset = 0;
+        for ( auto it = live.begin(); it != live.end() && it->offset < offset + size; ++it )
+        {
+            if ( !released(it->index, k) )
+            {
+                offset = std::max(offset, it->offset + it->size);
+            }
+        }
+        block allocated = { offset, size, k };
+        live.insert(std::upper_bound(live.begin(), live.end(), allocated, []( const block& a, const block& b ){ return a.offset < b.offset; }), allocated);
+
+        plan.offsets[intermediates[k]] = offset;
+        plan.size = std::max(plan.size, offset + size);
+    }
+    return plan;
+}
+
+// Lifetimes are operation index ranges from definition to last use in the order of
+// graph.operations, or at the given positions if operations are moved (fused)
+inline storage_plan plan_storage( const nnef::Graph& graph, const std::vector<std::string>& intermediates,
+                                  const std::vector<size_t>& sizes, const std::vector<size_t>& positions = std::vector<size_t>() )
+{
+    std::unordered_map<std::string, std::pair<size_t, size_t>> lifetimes;
+    for ( const auto& id : intermediates )
+    {
+        lifetimes[id] = std::make_pair(graph.operations.size(), 0);
+    }
+    for ( size_t k = 0; k < graph.operations.size(); ++k )
+    {
+        const auto& operation = graph.operations[k];
+        const size_t i = positions.empty() ? k : positions[k];
+        std::vector<std::string> ids;
+        for ( const auto& output : operation.outputs )
+        {
+            collect_identifiers(output.second, ids);
+        }
+        for ( const auto& id : ids )
+        {
+            auto it = lifetimes.find(id);
+            if ( it != lifetimes.end() )
+            {
+                it->second.first = std::min(it->second.first, i);
+                it->second.second = std::max(it->second.second, i);
+            }
+        }
+        ids.clear();
+        for ( const auto& input : operation.inputs )
+        {
+            collect_identifiers(input.second, ids);
+        }
+        for ( const auto& id : ids )
+        {
+            auto it = lifetimes.find(id);
+            if ( it != lifetimes.end() )
+            {
+                it->second.second = std::max(it->second.second, i);
+            }
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for ( const auto& id : intermediates )
+    {
+        ranges.push_back(lifetimes[id]);
+    }
+    auto released = [&ranges]( const size_t a, const size_t b ){ return ranges[a].second < ranges[b].first; };
+    return allocate_storage(intermediates, sizes, released, released);
+}
+
+#endif
@@ -0,0 +1,60 @@
+# Code generation benchmark of nnef2ada on a synthetic graph
+# usage: benchmark_nnef2ada.py <nnef2ada executable> [operations] [repeats] [nnef2ada options...]
+#
+# The graph is a chain of mul/relu/add operations on a [1, 16] tensor with an output every
+# 10 operations and at the end. The best wall time of repeats runs is reported, once writing
+# the units to stdout and once with --output to a directory.
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def write_graph(dir, operations):
+    lines = ['version 1.0;', '']
+    outputs = ['t%d' % i for i in range(operations) if i % 10 == 9 or i == operations - 1]
+    lines.append('graph Big( input ) -> ( %s )' % ', '.join(outputs))
+    lines.append('{')
+    lines.append('    input = external<scalar>(shape = [1, 16]);')
+    prev = 'input'
+    for i in range(operations):
+        if i % 3 == 0:
+            lines.append('    t%d = mul(%s, 1.5);' % (i, prev))
+        elif i % 3 == 1:
+            lines.append('    t%d = relu(%s);' % (i, prev))
+        else:
+            lines.append('    t%d = add(%s, 0.5);' % (i, prev))
+        prev = 't%d' % i
+    lines.append('}')
+    with open(os.path.join(dir, 'graph.nnef'), 'w') as file:
+        file.write('\n'.join(lines) + '\n')
+
+
+def best_time(command, repeats):
+    best = float('inf')
+    for _ in range(repeats):
+        start = time.perf_counter()
+        with open(os.devnull, 'w') as null:
+            result = subprocess.run(command, stdout=null, stderr=subprocess.PIPE, universal_newlines=True)
+        elapsed = time.perf_counter() - start
+        if result.returncode != 0:
+            sys.exit('%s failed:\n%s' % (' '.join(command), result.stderr))
+        best = min(best, elapsed)
+    return best
+
+
+if __name__ == '__main__':
+    tool = sys.argv[1]
+    operations = int(sys.argv[2]) if len(sys.argv) > 2 else 50000
+    repeats = int(sys.argv[3]) if len(sys.argv) > 3 else 3
+    options = sys.argv[4:]
+    with tempfile.TemporaryDirectory() as dir:
+        graph = os.path.join(dir, 'graph')
+        output = os.path.join(dir, 'output')
+        os.mkdir(graph)
+        os.mkdir(output)
+        write_graph(graph, operations)
+        print('operations: %d, repeats: %d, options: %s' % (operations, repeats, ' '.join(options) or 'none'))
+        print('stdout: %.3f s' % best_time([tool, graph] + options, repeats))
+        print('--output: %.3f s' % best_time([tool, graph, '--output', output] + options, repeats))
@@ -0,0 +1,154 @@
+# Golden-output tests of nnef2ada; usage: test_nnef2ada.py <nnef2ada executable> <case>
+import array
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+# two elementwise branches from the input that join before a matmul; intermediates are 16 bytes,
+# which the workspace rounds up to 64
+graph = '''version 1.0;
+
+graph Small( input ) -> ( output )
+{
+    input = external<scalar>(shape = [1, 4]);
+    w = variable<scalar>(shape = [1, 4], label = 'w');
+    m = variable<scalar>(shape = [4, 4], label = 'm');
+    a = mul(input, w);
+    b = relu(a);
+    c = add(b, 0.5);
+    d = sub(input, 0.5);
+    e = mul(d, d);
+    f = add(c, e);
+    g = matmul(f, m, transposeA = false, transposeB = false);
+    output = relu(g);
+}
+'''
+
+
+def write_tensor(path, shape, values):
+    data = array.array('f', values).tobytes()
+    extents = list(shape) + [0] * (8 - len(shape))
+    header = bytes([0x4E, 0xEF, 1, 0]) + struct.pack('<II8III', len(data), len(shape), *(extents + [32, 0])) + bytes(76)
+    with open(path, 'wb') as file:
+        file.write(header + data)
+
+
+def generate(dir, *options):
+    with open(os.path.join(dir, 'graph.nnef'), 'w') as file:
+        file.write(graph)
+    write_tensor(os.path.join(dir, 'w.dat'), [1, 4], range(4))
+    write_tensor(os.path.join(dir, 'm.dat'), [4, 4], range(16))
+    result = subprocess.run([tool, dir] + list(options), stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    assert result.returncode == 0, result.stderr
+    return result.stdout, result.stderr
+
+
+def unit(output, name):
+    # lines of one unit from its '-- <name>' header up to the next unit
+    lines = output.splitlines()
+    begin = lines.index('-- ' + name) + 1
+    end = next((i for i in range(begin, len(lines)) if re.match(r'-- \w+\.ad[sb]$', lines[i])), len(lines))
+    return lines[begin:end]
+
+
+def between(lines, first, last):
+    # stripped lines after the first line equal to first up to the next equal to last
+    lines = [line.strip() for line in lines]
+    begin = lines.index(first) + 1
+    return lines[begin:lines.index(last, begin)]
+
+
+def addresses(lines):
+    # 1-based workspace index of each overlaid tensor
+    found = [re.match(r"\s*(\w+): .* with Import, Address => Workspace \((\d+)\)'Address;$", line) for line in lines]
+    return dict((match.group(1), int(match.group(2))) for match in found if match)
+
+
+def test_workspace(dir):
+    # intermediates leave the spec and overlay a workspace where disjoint lifetimes share storage
+    output, _ = generate(dir, '--workspace')
+    spec, body = unit(output, 'Small.ads'), unit(output, 'Small.adb')
+    assert not [line for line in spec if re.match(r'\s*[a-g]: ', line)], spec
+    assert '    -- Intermediate tensors are private to the body, in a shared workspace' in spec, spec
+    assert '    Workspace: System.Storage_Elements.Storage_Array (1..192) with Alignment => 64;' in body, body
+    assert addresses(body) == dict(a=1, b=65, c=1, d=65, e=129, f=65, g=1), body
+
+
+def test_tasks(dir):
+    # the branches run on two workers joined by one event; tensors of concurrent operations never share storage
+    output, _ = generate(dir, '--tasks', '2', '--workspace')
+    body = unit(output, 'Small.adb')
+    for line in ['Events: array (1..1) of Completion;', 'Finish: array (1..2) of Completion;',
+                 'Worker_1: Worker (1);', 'Worker_2: Worker (2);']:
+        assert '    ' + line in body, (line, body)
+    assert between(body, 'case Index is', 'end case;') == [
+        'when 1 =>',
+        'mul (x => input, y => w, z => a);',
+        'relu (x => a, y => b);',
+        'add (x => b, y => 0.5, z => c);',
+        'Events (1).Signal;',
+        'when 2 =>',
+        'sub (x => input, y => 0.5, z => d);',
+        'mul (x => d, y => d, z => e);',
+        'Events (1).Wait;',
+        'add (x => c, y => e, z => f);',
+        'matmul (A => f, B => m, transposeA => false, transposeB => false, C => g);',
+        'relu (x => g, y => output);',
+        'when others =>',
+        'null;',
+    ], body
+    assert '    Workspace: System.Storage_Elements.Storage_Array (1..256) with Alignment => 64;' in body, body
+    assert addresses(body) == dict(a=1, b=65, c=1, d=129, e=193, f=65, g=1), body
+
+
+def test_fuse(dir):
+    # the elementwise operations before the matmul become one loop nest and only its result is stored
+    output, log = generate(dir, '--fuse')
+    spec, body = unit(output, 'Small.ads'), unit(output, 'Small.adb')
+    assert 'Fused 6 elementwise operations into 1 loops: eliminated 5 intermediate tensors (320 bytes)' in log, log
+    assert [line.split(':')[0].strip() for line in spec if re.match(r'\s*[a-g]: ', line)] == ['f', 'g'], spec
+    assert between(body, 'procedure Forward is', 'end Forward;') == [
+        'begin',
+        '-- fused: mul relu add sub mul add',
+        'for I1 in 1..1 loop',
+        'for I2 in 1..4 loop',
+        'declare',
+        'T1: constant Float := input (I1, I2) * w (I1, I2);',
+        'T2: constant Float := Float\'Max (T1, 0.0);',
+        'T3: constant Float := T2 + 0.5;',
+        'T4: constant Float := input (I1, I2) - 0.5;',
+        'T5: constant Float := T4 * T4;',
+        'begin',
+        'f (I1, I2) := T3 + T5;',
+        'end;',
+        'end loop;',
+        'end loop;',
+        'matmul (A => f, B => m, transposeA => false, transposeB => false, C => g);',
+        'relu (x => g, y => output);',
+    ], body
+
+
+def test_instrument(dir):
+    # profile labels carry the 1-based index of the operation in the graph, as in the trace%03u-<tensor>.dat
+    # files of infer; a fused loop is labelled with its last operation
+    statements = [line.strip() for line in graph.splitlines() if line.startswith('    ')]
+    index = dict((statement.split(' = ')[0], i + 1) for i, statement in enumerate(statements))
+    for options, expected in [(['--instrument', '1'], [('mul', 'a'), ('relu', 'b'), ('add', 'c'), ('sub', 'd'), ('mul', 'e'),
+                                                       ('add', 'f'), ('matmul', 'g'), ('relu', 'output')]),
+                              (['--fuse', '--instrument', '1'], [('fused_add', 'f'), ('matmul', 'g'), ('relu', 'output')])]:
+        output, _ = generate(dir, *options)
+        body = unit(output, 'Small.adb')
+        line = next(line for line in body if line.strip().startswith('Profile_Labels:'))
+        labels = [label.split() for label in re.findall(r'"([^"]*)"', line)]
+        assert labels == [['%d' % index[tensor], name, tensor] for name, tensor in expected], line
+
+
+cases = dict((name[5:], case) for name, case in globals().items() if name.startswith('test_'))
+
+if __name__ == '__main__':
+    tool = sys.argv[1]
+    with tempfile.TemporaryDirectory() as dir:
+        cases[sys.argv[2]](dir)
@@ -0,0 +1,174 @@
+# Regression tests of nnef2cpp: the generated program is compiled and its outputs are compared with a
+# pure-Python reference; usage: test_nnef2cpp.py <nnef2cpp executable> <C++ compiler> <case>
+import array
+import itertools
+import math
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+def volume(shape):
+    return math.prod(shape) if shape else 1
+
+
+def write_tensor(path, shape, values):
+    data = array.array('f', values).tobytes()
+    extents = list(shape) + [0] * (8 - len(shape))
+    header = bytes([0x4E, 0xEF, 1, 0]) + struct.pack('<II8III', len(data), len(shape), *(extents + [32, 0])) + bytes(76)
+    with open(path, 'wb') as file:
+        file.write(header + data)
+
+
+def read_tensor(path):
+    with open(path, 'rb') as file:
+        data = file.read()
+    rank = struct.unpack_from('<I', data, 8)[0]
+    return list(struct.unpack_from('<%dI' % rank, data, 12)), list(array.array('f', data[128:]))
+
+
+def offset(shape, index):
+    result = 0
+    for extent, i in zip(shape, index):
+        result = result * extent + i
+    return result
+
+
+def conv(x, x_shape, f, f_shape, bias, padding, stride, dilation, groups):
+    # bias is a list of one or per-output-channel values
+    spatial = x_shape[2:]
+    kernel = f_shape[2:]
+    y_spatial = [(extent + before + after - (k - 1) * d - 1) // s + 1
+                 for extent, (before, after), k, s, d in zip(spatial, padding, kernel, stride, dilation)]
+    y_shape = [x_shape[0], f_shape[0]] + y_spatial
+    group_channels, group_outputs = f_shape[1], f_shape[0] // groups
+    y = []
+    for n, o in itertools.product(range(y_shape[0]), range(y_shape[1])):
+        for position in itertools.product(*[range(extent) for extent in y_spatial]):
+            total = bias[o] if len(bias) > 1 else bias[0]
+            for c in range(group_channels):
+                for tap in itertools.product(*[range(k) for k in kernel]):
+                    index = [p * s + t * d - before for p, t, s, d, (before, _) in zip(position, tap, stride, dilation, padding)]
+                    if all(0 <= i < extent for i, extent in zip(index, spatial)):
+                        channel = o // group_outputs * group_channels + c
+                        total += x[offset(x_shape, [n, channel] + index)] * f[offset(f_shape, [o, c] + list(tap))]
+            y.append(total)
+    return y, y_shape
+
+
+def avg_pool(x, shape, size, padding):
+    # unit stride; padded items count as zeros in the average
+    y = []
+    for index in itertools.product(*[range(extent) for extent in shape]):
+        total = 0.0
+        for tap in itertools.product(*[range(k) for k in size]):
+            source = [i + t - before for i, t, (before, _) in zip(index, tap, padding)]
+            if all(0 <= i < extent for i, extent in zip(source, shape)):
+                total += x[offset(shape, source)]
+        y.append(total / volume(size))
+    return y
+
+
+def transpose(x, shape, axes):
+    y_shape = [shape[axis] for axis in axes]
+    y = [0.0] * len(x)
+    for index in itertools.product(*[range(extent) for extent in shape]):
+        y[offset(y_shape, [index[axis] for axis in axes])] = x[offset(shape, index)]
+    return y, y_shape
+
+
+def matmul(a, b, batch, m, k, n, transpose_a):
+    y = []
+    for i, row, col in itertools.product(range(batch), range(m), range(n)):
+        y.append(sum(a[i * m * k + (j * m + row if transpose_a else row * k + j)] * b[i * k * n + j * n + col] for j in range(k)))
+    return y
+
+
+def test_reference(dir):
+    # conv, pooling, layout, reduction, softmax, matmul and elementwise kernels with shared intermediate storage
+    model = os.path.join(dir, 'model')
+    os.mkdir(model)
+    with open(os.path.join(model, 'graph.nnef'), 'w') as file:
+        file.write('''version 1.0;
+
+graph Kernels( input, signal ) -> ( rd, mm1, mm2, cc, c1d, el )
+{
+    input = external<scalar>(shape = [2, 6, 7, 5]);
+    signal = external<scalar>(shape = [1, 2, 9]);
+    wg = variable<scalar>(shape = [6, 2, 3, 3], label = 'wg');
+    bg = variable<scalar>(shape = [1, 6], label = 'bg');
+    wb = variable<scalar>(shape = [2, 6, 4], label = 'wb');
+    w1d = variable<scalar>(shape = [3, 2, 3], label = 'w1d');
+    cv = conv(input, wg, bg, border = 'constant', padding = [(1, 0), (2, 1)], stride = [2, 2], dilation = [1, 2], groups = 3);
+    ap = avg_pool(cv, size = [1, 1, 2, 2], border = 'constant', padding = [(0, 0), (0, 0), (1, 0), (0, 1)], stride = [1, 1, 1, 1], dilation = []);
+    tp = transpose(ap, axes = [0, 2, 3, 1]);
+    sl = slice(tp, axes = [1, 3], begin = [1, 0], end = [3, 6], stride = [1, 2]);
+    rd = sum_reduce(sl, axes = [1, 2], normalize = false);
+    sm = softmax(tp, axes = [3]);
+    a = reshape(sm, shape = [2, 6, 6], axis_start = 0, axis_count = -1);
+    mm1 = matmul(a, wb, transposeA = false, transposeB = false);
+    mm2 = matmul(a, wb, transposeA = true, transposeB = false);
+    [sp1, sp2] = split(ap, axis = 1, ratios = [1, 2]);
+    cc = concat([sp2, sp1], axis = 1);
+    c1d = conv(signal, w1d, 0.25, border = 'constant', padding = [], stride = [2], dilation = [], groups = 1);
+    s1 = sub(cv, bg);
+    m1 = mul(s1, 0.5);
+    r1 = relu(m1);
+    g1 = gt(cv, 0.0);
+    sel = select(g1, r1, cv);
+    sg = sigmoid(ap);
+    el = max(sel, sg);
+}
+''')
+    generator = random.Random(5)
+    values = dict(input=[generator.uniform(-1, 1) for _ in range(2 * 6 * 7 * 5)], signal=[generator.uniform(-1, 1) for _ in range(18)])
+    weights = dict(wg=[6, 2, 3, 3], bg=[1, 6], wb=[2, 6, 4], w1d=[3, 2, 3])
+    for name, shape in weights.items():
+        values[name] = [0.1 * (i * 7 % 13) - 0.6 for i in range(volume(shape))]
+        write_tensor(os.path.join(model, name + '.dat'), shape, values[name])
+    write_tensor(os.path.join(dir, 'input.dat'), [2, 6, 7, 5], values['input'])
+    write_tensor(os.path.join(dir, 'signal.dat'), [1, 2, 9], values['signal'])
+
+    source, program = os.path.join(dir, 'kernels.cpp'), os.path.join(dir, 'kernels')
+    subprocess.run([tool, model, '--output', source], check=True)
+    subprocess.run([compiler, '-std=c++11', '-O1', source, '-o', program], check=True)
+    outputs = ['rd', 'mm1', 'mm2', 'cc', 'c1d', 'el']
+    subprocess.run([program, '--iterations', '1', '--input', os.path.join(dir, 'input.dat'), os.path.join(dir, 'signal.dat'),
+                    '--output'] + [os.path.join(dir, name + '.out.dat') for name in outputs], check=True)
+
+    cv, cv_shape = conv(values['input'], [2, 6, 7, 5], values['wg'], weights['wg'], values['bg'], [(1, 0), (2, 1)], [2, 2], [1, 2], 3)
+    ap = avg_pool(cv, cv_shape, [1, 1, 2, 2], [(0, 0), (0, 0), (1, 0), (0, 1)])
+    tp, tp_shape = transpose(ap, cv_shape, [0, 2, 3, 1])
+    sl_shape = [2, 2, 2, 3]
+    sl = [tp[offset(tp_shape, [n, 1 + h, w, 2 * c])] for n, h, w, c in itertools.product(*[range(extent) for extent in sl_shape])]
+    sm = []
+    for row in range(0, len(tp), 6):
+        exps = [math.exp(value - max(tp[row:row + 6])) for value in tp[row:row + 6]]
+        sm += [value / sum(exps) for value in exps]
+    channels = cv_shape[2] * cv_shape[3]
+    expected = dict(
+        rd=([2, 1, 1, 3], [sum(sl[offset(sl_shape, [n, h, w, c])] for h in range(2) for w in range(2)) for n in range(2) for c in range(3)]),
+        mm1=([2, 6, 4], matmul(sm, values['wb'], 2, 6, 6, 4, False)),
+        mm2=([2, 6, 4], matmul(sm, values['wb'], 2, 6, 6, 4, True)),
+        cc=(cv_shape, [value for n in range(2) for value in ap[(n * 6 + 2) * channels:(n + 1) * 6 * channels] + ap[n * 6 * channels:(n * 6 + 2) * channels]]),
+        c1d=([1, 3, 5], conv(values['signal'], [1, 2, 9], values['w1d'], weights['w1d'], [0.25], [(1, 1)], [2], [1], 1)[0]),
+        el=(cv_shape, [max(max((x - values['bg'][i // channels % 6]) * 0.5, 0.0) if x > 0 else x, 1 / (1 + math.exp(-p)))
+                       for i, (x, p) in enumerate(zip(cv, ap))]),
+    )
+    for name in outputs:
+        shape, result = read_tensor(os.path.join(dir, name + '.out.dat'))
+        reference_shape, reference = expected[name]
+        assert shape == reference_shape, (name, shape, reference_shape)
+        error = max(abs(a - b) for a, b in zip(result, reference))
+        assert error < 1e-5, (name, error)
+
+
+cases = dict((name[5:], case) for name, case in globals().items() if name.startswith('test_'))
+
+if __name__ == '__main__':
+    tool, compiler = sys.argv[1], sys.argv[2]
+    with tempfile.TemporaryDirectory() as dir:
+        cases[sys.argv[3]](dir)
@@ -0,0 +1,66 @@
+# Regression tests of nnef_tff_info; usage: test_nnef_tff_info.py <nnef_tff_info executable> <case>
+import array
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+def write_tensor(path, shape, values):
+    data = array.array('f', values).tobytes()
+    extents = list(shape) + [0] * (8 - len(shape))
+    header = bytes([0x4E, 0xEF, 1, 0]) + struct.pack('<II8III', len(data), len(shape), *(extents + [32, 0])) + bytes(76)
+    with open(path, 'wb') as file:
+        file.write(header + data)
+
+
+def run(*args):
+    result = subprocess.run([tool] + [str(arg) for arg in args], stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    return result.returncode, result.stdout
+
+
+def value_after(output, title):
+    lines = output.splitlines()
+    return lines[lines.index(title) + 1]
+
+
+def test_metrics_nan(dir):
+    # NaN items must show in the relative difference with and without --metrics
+    file1, file2 = os.path.join(dir, 'n1.dat'), os.path.join(dir, 'n2.dat')
+    write_tensor(file1, [4], [1, 2, 3, 4])
+    write_tensor(file2, [4], [1, float('nan'), 3, 4])
+    _, plain = run(file1, file2)
+    _, metrics = run(file1, file2, '--metrics')
+    assert value_after(plain, 'relative difference:') == 'nan', plain
+    assert value_after(metrics, 'relative difference:') == 'nan', metrics
+    assert value_after(metrics, 'nan mismatches:') == '1', metrics
+    assert value_after(metrics, 'non-finite pairs (excluded from the metrics above):') == '1', metrics
+
+
+def test_fail_fast_nan(dir):
+    # a chunk with a NaN difference exceeds any fail-fast threshold
+    file1, file2 = os.path.join(dir, 'n1.dat'), os.path.join(dir, 'n2.dat')
+    write_tensor(file1, [4], [1, 2, 3, 4])
+    write_tensor(file2, [4], [1, float('nan'), 3, 4])
+    code, output = run(file1, file2, '--fail-fast', 0.01)
+    assert code == 1, output
+    assert 'tolerance exceeded in items 0..3:' in output.splitlines(), output
+    code, output = run(file1, file2, '--stream')
+    assert code == 0 and value_after(output, 'relative difference:') == 'nan', output
+
+
+def test_csv_single_index_slice(dir):
+    # a single index on the last axis must not split the rows of the axes before it
+    file = os.path.join(dir, 't.dat')
+    write_tensor(file, [2, 3, 4], range(24))
+    code, output = run(file, '--format', 'csv', '--slice', '[:, :, 0]')
+    assert code == 0 and output.splitlines() == ['0,4,8', '12,16,20'], output
+
+
+cases = dict((name[5:], case) for name, case in globals().items() if name.startswith('test_'))
+
+if __name__ == '__main__':
+    tool = sys.argv[1]
+    with tempfile.TemporaryDirectory() as dir:
+        cases[sys.argv[2]](dir)